@@ -0,0 +1,9 @@
+// Heap allocation counting for benchmarks. Link alloc_counter.cpp into a
+// binary to replace the global operator new with a counting version.
+#pragma once
+#include <cstdint>
+
+namespace common {
+// Number of calls to operator new so far, across all threads
+uint64_t allocation_count();
+} // namespace common
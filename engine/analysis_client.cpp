@@ -0,0 +1,246 @@
+// Stand-in client for testing analysis_server locally.
+//
+// Usage: analysis_client [--socket PATH] [--clients N] [--requests N]
+//                        [--best-ms MS]
+// Each of the clients connects and sends its requests all at once, cycling
+// through legal, best and perft requests on a few positions, then checks
+// every answer against the engine run locally: the same legal moves and
+// perft counts, and a legal best move. Reports throughput and the server's
+// latencies, then its stats. Exits 1 if any answer is wrong or missing.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "perft.h"
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+const std::vector<std::string> kPositions = {
+    kInitialFen,
+    "16/8bk7/16/16/5br10/16/2bp13/16/16/16/16/10wq5/16/3wp12/16/7wk8 w wb - "
+    "0 60",
+    "16/4br3bk2br4/16/16/16/16/16/16/9br6/16/16/16/16/16/16/4wr3wk2wr4 w wb "
+    "KQkq 0 1",
+};
+
+struct Options {
+  std::string socket = "/tmp/sovereign_chess.sock";
+  int clients = 4;
+  int requests = 30;
+  int best_ms = 50;
+};
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return {};
+    }
+    std::string value = argv[++i];
+    if (arg == "--socket")
+      options.socket = value;
+    else if (arg == "--clients")
+      options.clients = std::stoi(value);
+    else if (arg == "--requests")
+      options.requests = std::stoi(value);
+    else if (arg == "--best-ms")
+      options.best_ms = std::stoi(value);
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      return {};
+    }
+  }
+  return options;
+}
+
+// -1 if the server can't be reached
+int connect_to(const std::string &path) {
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (path.size() >= sizeof(address.sun_path))
+    return -1;
+  std::strcpy(address.sun_path, path.c_str());
+  const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr *>(&address),
+                         sizeof(address)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool send_all(int fd, const std::string &data) {
+  for (std::size_t sent = 0; sent < data.size();) {
+    const ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+    if (n <= 0)
+      return false;
+    sent += n;
+  }
+  return true;
+}
+
+// Reads lines until count have arrived or the server hangs up
+std::vector<std::string> read_lines(int fd, std::size_t count) {
+  std::vector<std::string> lines;
+  std::string input;
+  char buffer[4096];
+  while (lines.size() < count) {
+    const ssize_t n = read(fd, buffer, sizeof(buffer));
+    if (n <= 0)
+      break;
+    input.append(buffer, n);
+    for (std::size_t end; (end = input.find('\n')) != std::string::npos;) {
+      lines.push_back(input.substr(0, end));
+      input.erase(0, end + 1);
+    }
+  }
+  return lines;
+}
+
+struct Expected {
+  std::string kind;
+  std::string fen;
+  std::vector<std::string> legal_moves; // sorted
+  uint64_t perft = 0;
+};
+
+// Empty if answer (after "ID ok LATENCY_US") is right
+std::optional<std::string> check(const Expected &expected,
+                                 const std::string &answer) {
+  std::istringstream in(answer);
+  std::vector<std::string> words;
+  for (std::string word; in >> word;)
+    words.push_back(word);
+  if (expected.kind == "legal") {
+    std::sort(words.begin(), words.end());
+    if (words != expected.legal_moves)
+      return "wrong legal moves";
+  } else if (expected.kind == "perft") {
+    if (words.size() != 1 || words[0] != std::to_string(expected.perft))
+      return "wrong perft count";
+  } else if (words.empty() ||
+             !std::binary_search(expected.legal_moves.begin(),
+                                 expected.legal_moves.end(), words[0])) {
+    return "illegal best move";
+  }
+  return {};
+}
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  // Answers are worked out locally once per position
+  std::vector<Expected> expected;
+  for (const std::string &fen : kPositions) {
+    Expected position{"", fen, {}, perft(Board::from_fen(fen), 2)};
+    for (const Move &move : Game::get_legal_moves(Board::from_fen(fen)))
+      position.legal_moves.push_back(move.to_string());
+    std::sort(position.legal_moves.begin(), position.legal_moves.end());
+    for (const char *kind : {"legal", "best", "perft"}) {
+      position.kind = kind;
+      expected.push_back(position);
+    }
+  }
+
+  std::atomic<int> failures = 0;
+  std::mutex latencies_mutex;
+  std::vector<uint64_t> latencies;
+  const auto start = std::chrono::steady_clock::now();
+  std::vector<std::thread> clients;
+  for (int client = 0; client < options->clients; client++) {
+    clients.emplace_back([&, client] {
+      const int fd = connect_to(options->socket);
+      if (fd < 0) {
+        std::cerr << "Can't connect to " << options->socket << "\n";
+        failures++;
+        return;
+      }
+      std::ostringstream requests;
+      std::map<std::string, const Expected *> by_id;
+      for (int i = 0; i < options->requests; i++) {
+        const Expected &request = expected[(client + i) % expected.size()];
+        const std::string id = std::to_string(client) + "-" + std::to_string(i);
+        by_id[id] = &request;
+        requests << id << " " << request.kind << " ";
+        if (request.kind == "best")
+          requests << options->best_ms << " ";
+        else if (request.kind == "perft")
+          requests << "2 ";
+        requests << request.fen << "\n";
+      }
+      send_all(fd, requests.str());
+      for (const std::string &line : read_lines(fd, by_id.size())) {
+        std::istringstream in(line);
+        std::string id, status;
+        uint64_t micros = 0;
+        in >> id >> status >> micros;
+        std::string answer;
+        std::getline(in, answer);
+        auto it = by_id.find(id);
+        std::optional<std::string> error =
+            it == by_id.end() ? "unexpected answer"
+            : status != "ok"  ? "error"
+                              : check(*it->second, answer);
+        if (error) {
+          std::cerr << *error << ": " << line << "\n";
+          failures++;
+        } else {
+          std::lock_guard lock(latencies_mutex);
+          latencies.push_back(micros);
+        }
+        if (it != by_id.end())
+          by_id.erase(it);
+      }
+      if (!by_id.empty()) {
+        std::cerr << by_id.size() << " requests unanswered\n";
+        failures++;
+      }
+      close(fd);
+    });
+  }
+  for (auto &client : clients)
+    client.join();
+  const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+
+  std::sort(latencies.begin(), latencies.end());
+  std::cout << latencies.size() << " answers in " << elapsed.count() << "s, "
+            << latencies.size() / elapsed.count() << " requests/s\n";
+  if (!latencies.empty())
+    std::cout << "Latency: p50 " << latencies[latencies.size() / 2]
+              << "us max " << latencies.back() << "us\n";
+
+  const int fd = connect_to(options->socket);
+  if (fd >= 0 && send_all(fd, "stats stats\n")) {
+    for (const std::string &line : read_lines(fd, 1))
+      std::cout << line << "\n";
+  }
+  if (fd >= 0)
+    close(fd);
+  if (failures) {
+    std::cout << failures << " failures\n";
+    return 1;
+  }
+  return 0;
+}
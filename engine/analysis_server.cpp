@@ -0,0 +1,535 @@
+// Long-running analysis daemon answering many clients over a Unix domain
+// socket, so that they share one thread pool and transposition table rather
+// than each starting an engine.
+//
+// Usage: analysis_server [--socket PATH] [--threads N] [--hash MB]
+//                        [--batch-ms MS] [--max-batch N]
+// Requests and responses are lines of text. A connection may send any
+// number of requests without waiting; each is answered when it finishes,
+// so answers can arrive out of order and are matched by ID:
+//   ID legal FEN        ->  ID ok LATENCY_US MOVE...
+//   ID best MS FEN      ->  ID ok LATENCY_US MOVE|0000 score S depth D nodes N
+//   ID perft DEPTH FEN  ->  ID ok LATENCY_US COUNT
+//   ID stats            ->  ID ok LATENCY_US requests N batches N
+//                           KIND count N mean_us N p50_us N p99_us N max_us N
+//   (any failure)       ->  ID error MESSAGE
+// Latency is from reading the request to writing its answer. Requests
+// arriving within the batch window are queued to the pool together, and
+// identical legal and perft requests in a batch are computed once. A client
+// that leaves more than 1 MiB of answers unread is disconnected. See
+// analysis_client.cpp for a stand-in client; socat also works by hand.
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "perft.h"
+#include "position_history.h"
+#include "search.h"
+#include "sovereign_chess.h"
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+using Clock = std::chrono::steady_clock;
+
+constexpr int kMaxBudgetMs = 60000;
+constexpr int kMaxPerftDepth = 5;
+constexpr std::size_t kMaxLineLength = 4096;
+constexpr std::size_t kMaxQueuedOutput = 1 << 20;
+
+struct Options {
+  std::string socket = "/tmp/sovereign_chess.sock";
+  unsigned threads = common::ThreadPool::default_workers() + 1;
+  std::size_t hash_megabytes = 64;
+  double batch_seconds = 0.002;
+  std::size_t max_batch = 64;
+};
+
+// A client connection, with its socket non-blocking. Answers are queued from
+// pool threads and sent as the socket takes them, the rest by the poll loop
+// when it is writable, so a client that doesn't read its answers can't hold
+// up a worker. The socket is closed once the connection is dropped and no
+// request holds it.
+class Connection {
+public:
+  explicit Connection(int fd) : fd_(fd) {}
+  ~Connection() { close(fd_); }
+  Connection(const Connection &) = delete;
+  Connection &operator=(const Connection &) = delete;
+
+  int fd() const { return fd_; }
+  // Read by the accepting thread only
+  std::string &input() { return input_; }
+  bool reading() const { return reading_; }
+  void stop_reading() { reading_ = false; }
+
+  // Clients that have gone away, or let more than kMaxQueuedOutput bytes of
+  // answers pile up, are failed and get nothing more
+  void send_line(const std::string &line) {
+    std::lock_guard lock(output_mutex_);
+    if (failed_)
+      return;
+    output_ += line;
+    output_ += '\n';
+    if (output_.size() > kMaxQueuedOutput) {
+      failed_ = true;
+      output_.clear();
+      return;
+    }
+    send_queued();
+  }
+  // Sends what the socket takes of the queued output
+  void flush() {
+    std::lock_guard lock(output_mutex_);
+    send_queued();
+  }
+  bool has_output() {
+    std::lock_guard lock(output_mutex_);
+    return !output_.empty();
+  }
+  bool failed() {
+    std::lock_guard lock(output_mutex_);
+    return failed_;
+  }
+
+private:
+  void send_queued() {
+    while (!output_.empty() && !failed_) {
+      const ssize_t n =
+          send(fd_, output_.data(), output_.size(), MSG_NOSIGNAL);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+      if (n <= 0) {
+        failed_ = true;
+        output_.clear();
+        return;
+      }
+      output_.erase(0, n);
+    }
+  }
+
+  int fd_;
+  std::string input_;
+  bool reading_ = true;
+  std::mutex output_mutex_;
+  std::string output_; // queued, not yet sent
+  bool failed_ = false;
+};
+
+enum class Kind { Legal, Best, Perft, Stats };
+constexpr std::array<const char *, 4> kKindNames = {"legal", "best", "perft",
+                                                    "stats"};
+
+struct Request {
+  std::shared_ptr<Connection> connection;
+  std::string id;
+  Kind kind;
+  int argument = 0; // milliseconds for best, depth for perft
+  std::string fen;
+  Clock::time_point received;
+
+  // Identical requests have identical answers, except best, which depends
+  // on the table and timing
+  std::optional<std::string> dedup_key() const {
+    if (kind != Kind::Legal && kind != Kind::Perft)
+      return {};
+    return std::to_string(static_cast<int>(kind)) + " " +
+           std::to_string(argument) + " " + fen;
+  }
+};
+
+// The request on line, or the error to answer with
+std::variant<Request, std::string> parse_request(const std::string &line) {
+  std::istringstream in(line);
+  Request request;
+  std::string kind;
+  in >> request.id >> kind;
+  if (request.id.empty())
+    return std::string("error empty request");
+  const auto it = std::find(kKindNames.begin(), kKindNames.end(), kind);
+  if (it == kKindNames.end())
+    return request.id + " error unknown request " + kind;
+  request.kind = static_cast<Kind>(it - kKindNames.begin());
+  if (request.kind == Kind::Stats)
+    return request;
+  if (request.kind != Kind::Legal && !(in >> request.argument))
+    return request.id + " error missing " +
+           (request.kind == Kind::Best ? "budget" : "depth");
+  if (request.kind == Kind::Best &&
+      (request.argument < 1 || request.argument > kMaxBudgetMs))
+    return request.id + " error budget must be 1 to " +
+           std::to_string(kMaxBudgetMs) + " ms";
+  if (request.kind == Kind::Perft &&
+      (request.argument < 0 || request.argument > kMaxPerftDepth))
+    return request.id + " error depth must be 0 to " +
+           std::to_string(kMaxPerftDepth);
+  std::getline(in >> std::ws, request.fen);
+  if (!is_valid_fen(request.fen))
+    return request.id + " error invalid FEN";
+  return request;
+}
+
+/** Latencies by request kind: totals, and the most recent ones for
+ * percentiles.
+ */
+class Metrics {
+public:
+  void record(Kind kind, uint64_t micros) {
+    std::lock_guard lock(mutex_);
+    KindStats &stats = kinds_[static_cast<int>(kind)];
+    stats.recent[stats.count % stats.recent.size()] = micros;
+    stats.count++;
+    stats.total += micros;
+    stats.max = std::max(stats.max, micros);
+  }
+  void record_batch() {
+    std::lock_guard lock(mutex_);
+    batches_++;
+  }
+
+  std::string summary() {
+    std::lock_guard lock(mutex_);
+    uint64_t requests = 0;
+    for (const KindStats &stats : kinds_)
+      requests += stats.count;
+    std::ostringstream out;
+    out << "requests " << requests << " batches " << batches_;
+    for (std::size_t kind = 0; kind < kinds_.size(); kind++) {
+      const KindStats &stats = kinds_[kind];
+      std::vector<uint64_t> recent(
+          stats.recent.begin(),
+          stats.recent.begin() + std::min(stats.count, stats.recent.size()));
+      std::sort(recent.begin(), recent.end());
+      const auto percentile = [&](double p) {
+        return recent.empty()
+                   ? 0
+                   : recent[static_cast<std::size_t>((recent.size() - 1) * p)];
+      };
+      out << " " << kKindNames[kind] << " count " << stats.count
+          << " mean_us " << stats.total / std::max<uint64_t>(stats.count, 1)
+          << " p50_us " << percentile(0.5) << " p99_us " << percentile(0.99)
+          << " max_us " << stats.max;
+    }
+    return out.str();
+  }
+
+private:
+  struct KindStats {
+    std::size_t count = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    std::array<uint64_t, 1024> recent{};
+  };
+  std::mutex mutex_;
+  std::array<KindStats, kKindNames.size()> kinds_;
+  uint64_t batches_ = 0;
+};
+
+/** Collects requests into batches and runs them on the pool. Every search
+ * shares one transposition table, so positions that many clients analyze
+ * are searched once.
+ */
+class Dispatcher {
+public:
+  explicit Dispatcher(const Options &options)
+      : options_(options), table_(options.hash_megabytes),
+        pool_(std::max(options.threads, 1u) - 1) {
+    thread_ = std::thread([this] { run(); });
+  }
+
+  // Interrupts searches and waits for the requests in progress
+  ~Dispatcher() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    stop_searches_ = true;
+    cv_.notify_all();
+    thread_.join();
+  }
+
+  void add(Request request) {
+    {
+      std::lock_guard lock(mutex_);
+      pending_.push_back(std::move(request));
+    }
+    cv_.notify_all();
+  }
+
+private:
+  void run() {
+    while (true) {
+      std::vector<Request> batch;
+      {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (stopping_)
+          return;
+        // Give requests arriving together a moment to join the batch
+        cv_.wait_for(
+            lock, std::chrono::duration<double>(options_.batch_seconds),
+            [this] {
+              return stopping_ || pending_.size() >= options_.max_batch;
+            });
+        const std::size_t size = std::min(pending_.size(), options_.max_batch);
+        std::move(pending_.begin(), pending_.begin() + size,
+                  std::back_inserter(batch));
+        pending_.erase(pending_.begin(), pending_.begin() + size);
+      }
+      dispatch(std::move(batch));
+    }
+  }
+
+  // Queues each distinct request of the batch to the pool, answering its
+  // duplicates along with it
+  void dispatch(std::vector<Request> batch) {
+    metrics_.record_batch();
+    std::vector<std::vector<Request>> groups;
+    std::unordered_map<std::string, std::size_t> group_by_key;
+    for (Request &request : batch) {
+      const auto key = request.dedup_key();
+      if (key) {
+        auto [it, inserted] = group_by_key.emplace(*key, groups.size());
+        if (!inserted) {
+          groups[it->second].push_back(std::move(request));
+          continue;
+        }
+      }
+      groups.emplace_back().push_back(std::move(request));
+    }
+    for (auto &group : groups) {
+      pool_.submit([this, group = std::move(group)] {
+        const std::string answer = compute(group.front());
+        for (const Request &request : group) {
+          const uint64_t micros =
+              std::chrono::duration_cast<std::chrono::microseconds>(
+                  Clock::now() - request.received)
+                  .count();
+          metrics_.record(request.kind, micros);
+          request.connection->send_line(request.id + " ok " +
+                                        std::to_string(micros) + " " + answer);
+        }
+      });
+    }
+  }
+
+  std::string compute(const Request &request) {
+    if (request.kind == Kind::Stats)
+      return metrics_.summary();
+    const Board board = Board::from_fen(request.fen);
+    std::ostringstream out;
+    switch (request.kind) {
+    case Kind::Legal: {
+      const char *separator = "";
+      for (const Move &move : Game::get_legal_moves(board)) {
+        out << separator << move.to_string();
+        separator = " ";
+      }
+      break;
+    }
+    case Kind::Best: {
+      Searcher searcher(table_);
+      const SearchResult result = searcher.search(
+          board, {},
+          {.seconds = request.argument / 1000.0, .stop = &stop_searches_});
+      out << (result.best_move ? result.best_move->to_string() : "0000")
+          << " score " << result.score << " depth " << result.depth
+          << " nodes " << result.nodes;
+      break;
+    }
+    case Kind::Perft:
+      out << perft(board, request.argument);
+      break;
+    case Kind::Stats:
+      break;
+    }
+    return out.str();
+  }
+
+  Options options_;
+  TranspositionTable table_;
+  Metrics metrics_;
+  std::atomic<bool> stop_searches_ = false;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<Request> pending_;
+  bool stopping_ = false;
+  std::thread thread_;
+  // Last, so that it finishes queued requests before the rest is destroyed
+  common::ThreadPool pool_;
+};
+
+volatile std::sig_atomic_t interrupted = 0;
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return {};
+    }
+    std::string value = argv[++i];
+    if (arg == "--socket")
+      options.socket = value;
+    else if (arg == "--threads")
+      options.threads = std::stoi(value);
+    else if (arg == "--hash")
+      options.hash_megabytes = std::stoul(value);
+    else if (arg == "--batch-ms")
+      options.batch_seconds = std::stod(value) / 1000;
+    else if (arg == "--max-batch")
+      options.max_batch = std::max(std::stoul(value), 1ul);
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      return {};
+    }
+  }
+  return options;
+}
+
+// Reads what the client has sent and queues its complete lines. False once
+// the connection should close.
+bool read_requests(Connection &connection,
+                   const std::shared_ptr<Connection> &shared,
+                   Dispatcher &dispatcher) {
+  char buffer[4096];
+  const ssize_t n = read(connection.fd(), buffer, sizeof(buffer));
+  if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return true;
+  if (n <= 0)
+    return false;
+  std::string &input = connection.input();
+  input.append(buffer, n);
+  std::size_t start = 0;
+  for (std::size_t end; (end = input.find('\n', start)) != std::string::npos;
+       start = end + 1) {
+    std::string line = input.substr(start, end - start);
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.find_first_not_of(" \t") == std::string::npos)
+      continue;
+    auto parsed = parse_request(line);
+    if (auto *error = std::get_if<std::string>(&parsed)) {
+      connection.send_line(*error);
+      continue;
+    }
+    Request &request = std::get<Request>(parsed);
+    request.connection = shared;
+    request.received = Clock::now();
+    dispatcher.add(std::move(request));
+  }
+  input.erase(0, start);
+  return input.size() <= kMaxLineLength;
+}
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (options->socket.size() >= sizeof(address.sun_path)) {
+    std::cerr << "Socket path too long\n";
+    return 1;
+  }
+  std::strcpy(address.sun_path, options->socket.c_str());
+  const int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+  unlink(address.sun_path);
+  if (listener < 0 ||
+      bind(listener, reinterpret_cast<sockaddr *>(&address),
+           sizeof(address)) != 0 ||
+      listen(listener, 128) != 0) {
+    std::cerr << "Can't listen on " << options->socket << ": "
+              << std::strerror(errno) << "\n";
+    return 1;
+  }
+  std::signal(SIGINT, [](int) { interrupted = 1; });
+  std::signal(SIGTERM, [](int) { interrupted = 1; });
+  std::cout << "Listening on " << options->socket << std::endl;
+
+  {
+    Dispatcher dispatcher(*options);
+    std::map<int, std::shared_ptr<Connection>> connections; // by fd
+    while (!interrupted) {
+      // Drop failed clients, and closed ones once their answers are sent
+      for (auto it = connections.begin(); it != connections.end();) {
+        const auto &connection = it->second;
+        if (connection->failed()) {
+          shutdown(it->first, SHUT_RDWR);
+          it = connections.erase(it);
+        } else if (!connection->reading() && connection.use_count() == 1 &&
+                   !connection->has_output()) {
+          it = connections.erase(it);
+        } else {
+          ++it;
+        }
+      }
+
+      std::vector<pollfd> fds = {{listener, POLLIN, 0}};
+      for (const auto &[fd, connection] : connections) {
+        short events = connection->reading() ? POLLIN : 0;
+        if (connection->has_output())
+          events |= POLLOUT;
+        if (events)
+          fds.push_back({fd, events, 0});
+      }
+      // Wake up now and then to notice signals, and output queued by
+      // workers that the socket didn't take
+      if (poll(fds.data(), fds.size(), 200) <= 0)
+        continue;
+      if (fds[0].revents & POLLIN) {
+        const int fd = accept(listener, nullptr, nullptr);
+        if (fd >= 0) {
+          fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+          connections[fd] = std::make_shared<Connection>(fd);
+        }
+      }
+      for (std::size_t i = 1; i < fds.size(); i++) {
+        if (!fds[i].revents)
+          continue;
+        const auto connection = connections.at(fds[i].fd);
+        if (fds[i].revents & (POLLOUT | POLLHUP | POLLERR))
+          connection->flush();
+        if (connection->reading() && fds[i].revents & ~POLLOUT &&
+            !read_requests(*connection, connection, dispatcher)) {
+          // Dropped once its requests in progress are answered
+          shutdown(fds[i].fd, SHUT_RD);
+          connection->stop_reading();
+        }
+      }
+    }
+  }
+  close(listener);
+  unlink(address.sun_path);
+  return 0;
+}
@@ -0,0 +1,122 @@
+// Bump allocator for short-lived scratch memory in search and perft
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace common {
+
+/** Memory is carved from large blocks that are never returned to the system.
+ * Individual deallocations are no-ops; instead everything allocated after an
+ * ArenaScope was opened is released when the scope closes, and reset() frees
+ * everything in O(1).
+ */
+class Arena {
+public:
+  explicit Arena(std::size_t block_size = 1 << 20) : block_size_(block_size) {}
+
+  Arena(const Arena &) = delete;
+  Arena &operator=(const Arena &) = delete;
+
+  void *allocate(std::size_t bytes, std::size_t alignment) {
+    while (true) {
+      if (block_ < blocks_.size()) {
+        std::size_t start = (offset_ + alignment - 1) & ~(alignment - 1);
+        if (start + bytes <= blocks_[block_].size) {
+          offset_ = start + bytes;
+          return blocks_[block_].data.get() + start;
+        }
+        block_++;
+        offset_ = 0;
+      } else {
+        std::size_t size = std::max(block_size_, bytes + alignment);
+        blocks_.push_back({std::make_unique<std::byte[]>(size), size});
+      }
+    }
+  }
+
+  void reset() {
+    block_ = 0;
+    offset_ = 0;
+  }
+
+  // Position to rewind to, see ArenaScope
+  struct Mark {
+    std::size_t block;
+    std::size_t offset;
+  };
+  Mark mark() const { return {block_, offset_}; }
+  void rewind(Mark mark) {
+    block_ = mark.block;
+    offset_ = mark.offset;
+  }
+
+  // Total bytes reserved from the system
+  std::size_t capacity() const {
+    std::size_t total = 0;
+    for (const auto &block : blocks_)
+      total += block.size;
+    return total;
+  }
+
+private:
+  struct Block {
+    std::unique_ptr<std::byte[]> data;
+    std::size_t size;
+  };
+
+  std::size_t block_size_;
+  std::vector<Block> blocks_;
+  std::size_t block_ = 0;
+  std::size_t offset_ = 0;
+};
+
+// The calling thread's arena
+inline Arena &thread_arena() {
+  static thread_local Arena arena;
+  return arena;
+}
+
+// Releases everything allocated from an arena during the scope's lifetime.
+// Scopes must nest.
+class ArenaScope {
+public:
+  explicit ArenaScope(Arena &arena = thread_arena())
+      : arena_(arena), mark_(arena.mark()) {}
+  ~ArenaScope() { arena_.rewind(mark_); }
+
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  Arena &arena_;
+  Arena::Mark mark_;
+};
+
+// Standard allocator interface over an Arena, for containers
+template <typename T> class ArenaAllocator {
+public:
+  using value_type = T;
+
+  ArenaAllocator() : arena_(&thread_arena()) {}
+  explicit ArenaAllocator(Arena &arena) : arena_(&arena) {}
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &other) : arena_(other.arena()) {}
+
+  T *allocate(std::size_t n) {
+    return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *, std::size_t) {}
+
+  Arena *arena() const { return arena_; }
+
+  template <typename U> bool operator==(const ArenaAllocator<U> &other) const {
+    return arena_ == other.arena();
+  }
+
+private:
+  Arena *arena_;
+};
+
+} // namespace common
@@ -0,0 +1,54 @@
+#include "batch.h"
+
+#include "binary_position.h"
+
+namespace sovereign_chess {
+
+namespace {
+void write_legal_moves(const Board &board, std::size_t index,
+                       BatchOutput out) {
+  auto legal_moves = Game::get_legal_moves(board);
+  PackedMove *slots = out.moves + index * kMaxMovesPerPosition;
+  std::size_t written = std::min(legal_moves.size(), kMaxMovesPerPosition);
+  for (std::size_t i = 0; i < written; i++)
+    slots[i] = pack_move(legal_moves[i]);
+  out.counts[index] = legal_moves.size();
+}
+} // namespace
+
+void get_legal_moves_batch(const std::vector<std::string_view> &fens,
+                           BatchOutput out, common::ThreadPool &pool) {
+  pool.parallel_for(fens.size(), [&](std::size_t i) {
+    write_legal_moves(Board::from_fen(fens[i]), i, out);
+  });
+}
+
+void get_legal_moves_batch(const uint8_t *records, std::size_t size,
+                           std::size_t count, BatchOutput out,
+                           common::ThreadPool &pool) {
+  // Records are variable length, so find where each one starts before
+  // decoding them in parallel
+  std::vector<std::size_t> offsets;
+  offsets.reserve(count);
+  std::size_t offset = 0;
+  for (std::size_t i = 0; i < count; i++) {
+    std::size_t record_size = encoded_size(records + offset, size - offset);
+    if (record_size == 0 || offset + record_size > size)
+      break;
+    offsets.push_back(offset);
+    offset += record_size;
+  }
+  // Truncated input: positions past the end have no moves
+  for (std::size_t i = offsets.size(); i < count; i++)
+    out.counts[i] = 0;
+
+  pool.parallel_for(offsets.size(), [&](std::size_t i) {
+    Board board;
+    if (decode_position(records + offsets[i], size - offsets[i], board))
+      write_legal_moves(board, i, out);
+    else
+      out.counts[i] = 0; // corrupt record
+  });
+}
+
+} // namespace sovereign_chess
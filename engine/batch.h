@@ -0,0 +1,33 @@
+// Legal move generation for many positions at once
+#pragma once
+#include <string_view>
+#include <vector>
+
+#include "sovereign_chess.h"
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+// Output slots reserved per position. Positions with more legal moves report
+// their full count but only the first kMaxMovesPerPosition moves are written.
+constexpr std::size_t kMaxMovesPerPosition = 512;
+
+/** Caller-allocated output for a batch of n positions.
+ * - moves: n * kMaxMovesPerPosition entries; the moves of position i start at
+ *   moves[i * kMaxMovesPerPosition]
+ * - counts: n entries, the number of legal moves of each position
+ */
+struct BatchOutput {
+  PackedMove *moves;
+  uint32_t *counts;
+};
+
+void get_legal_moves_batch(const std::vector<std::string_view> &fens,
+                           BatchOutput out, common::ThreadPool &pool);
+
+// records holds count back-to-back binary position records
+void get_legal_moves_batch(const uint8_t *records, std::size_t size,
+                           std::size_t count, BatchOutput out,
+                           common::ThreadPool &pool);
+
+} // namespace sovereign_chess
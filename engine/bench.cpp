@@ -0,0 +1,267 @@
+// Microbenchmarks for engine primitives, on opening, midgame and endgame
+// positions.
+//
+// Usage: bench [--json FILE] [--min-time SECONDS] [--filter TEXT]
+// Results are printed as they run, and written to FILE as JSON if given, so
+// that runs on different commits can be diffed. Each result has the time and
+// heap allocations per call. Only benchmarks whose names contain TEXT run.
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "alloc_counter.h"
+#include "generic_bots.h"
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+struct BenchPosition {
+  const char *name;
+  std::string fen;
+};
+
+// Positions are fixed so that results stay comparable across commits
+const std::vector<BenchPosition> kCorpus = {
+    {"opening", kInitialFen},
+    // 60 random plies from the start
+    {"midgame",
+     "aqabvrvn2bb3bn1ynyrsbsq/aranvpvp1bp1bk1bp2ypypsnsr/"
+     "nbnpwb1br2bpbp2br2opob/nqnp4bp2bp1bp2opoq/crcp7bb4rprr/cncp12rprn/"
+     "gbgp4bq7pppb/gqgp12pppq/yqypbn11vpvq/ybyp8wb3vpvb/onop4wr7npnn/"
+     "orop6wp5npnr/rqrpsn2wp3wp4cpcq/rbrp3wp1wp2wp3cpcb/"
+     "sr1pppp2wpwn3wpgpgpanar/sqsbprpn3wqwk1wnwrgngrabaq w wb K 0 31"},
+    {"endgame", "16/8bk7/16/16/5br10/16/2bp13/16/16/16/16/10wq5/16/3wp12/"
+                "16/7wk8 w wb - 0 60"},
+};
+
+struct Options {
+  std::string json;
+  double min_seconds = 0.2;
+  std::string filter;
+};
+
+struct BenchResult {
+  std::string name;
+  std::string position; // empty for position-independent benchmarks
+  double ns;
+  double allocations;
+  std::size_t bytes; // of the data copied, 0 for benchmarks that don't copy
+};
+
+// Keep the compiler from optimizing away a benchmarked value
+template <typename T> void do_not_optimize(T &value) {
+  asm volatile("" : : "r"(&value) : "memory");
+}
+
+class Bench {
+public:
+  explicit Bench(const Options &options) : options_(options) {}
+
+  // Run fn in growing batches until a batch takes at least the minimum
+  // time, and record the time and allocations per call
+  template <typename F>
+  void run(const std::string &name, const std::string &position, F &&fn,
+           std::size_t bytes = 0) {
+    if (name.find(options_.filter) == std::string::npos)
+      return;
+    const double min_ns = options_.min_seconds * 1e9;
+    for (long iterations = 1;; iterations *= 2) {
+      const uint64_t allocations_before = common::allocation_count();
+      auto start = std::chrono::steady_clock::now();
+      for (long i = 0; i < iterations; i++)
+        fn();
+      std::chrono::duration<double, std::nano> elapsed =
+          std::chrono::steady_clock::now() - start;
+      const uint64_t allocations =
+          common::allocation_count() - allocations_before;
+      if (elapsed.count() >= min_ns) {
+        report({name, position, elapsed.count() / iterations,
+                static_cast<double>(allocations) / iterations, bytes});
+        return;
+      }
+    }
+  }
+
+  void write_json(std::ostream &out) const {
+    out << "{\n  \"benchmarks\": [";
+    for (std::size_t i = 0; i < results_.size(); i++) {
+      const BenchResult &result = results_[i];
+      out << (i ? ",\n" : "\n") << "    {\"name\": \"" << result.name
+          << "\", \"position\": \"" << result.position
+          << "\", \"ns\": " << result.ns
+          << ", \"allocations\": " << result.allocations;
+      if (result.bytes)
+        out << ", \"bytes\": " << result.bytes;
+      out << "}";
+    }
+    out << "\n  ]\n}\n";
+  }
+
+private:
+  void report(const BenchResult &result) {
+    std::cout << result.name;
+    if (!result.position.empty())
+      std::cout << " (" << result.position << ")";
+    std::cout << ": " << result.ns << " ns, " << result.allocations
+              << " allocations";
+    if (result.bytes)
+      std::cout << ", " << result.bytes << " bytes";
+    std::cout << std::endl;
+    results_.push_back(result);
+  }
+
+  Options options_;
+  std::vector<BenchResult> results_;
+};
+
+void bench_board_copy(Bench &bench) {
+  const Board board = Board::from_fen(kInitialFen);
+  Board copy;
+  bench.run(
+      "Board copy", "",
+      [&] {
+        do_not_optimize(board);
+        copy = board;
+        do_not_optimize(copy);
+      },
+      sizeof(Board));
+
+  alignas(Board) char raw[sizeof(Board)];
+  bench.run(
+      "memcpy of the same size", "",
+      [&] {
+        do_not_optimize(board);
+        std::memcpy(raw, &board, sizeof(Board));
+        do_not_optimize(raw);
+      },
+      sizeof(Board));
+}
+
+void bench_color_scan(Bench &bench) {
+  const Board board = Board::from_fen(kInitialFen);
+  const ColorMask colors = board.controlled_colors(Player::Player1);
+  alignas(32) std::array<uint8_t, 256> squares;
+  for (int square = 0; square < 256; square++)
+    squares[square] = board.packed_at(square);
+
+  bench.run("Color scan, scalar", "", [&] {
+    do_not_optimize(squares);
+    SquareSet set = squares_with_colors_scalar(squares.data(), colors);
+    do_not_optimize(set);
+  });
+  bench.run("Color scan, dispatched", "", [&] {
+    do_not_optimize(squares);
+    SquareSet set = squares_with_colors(squares.data(), colors);
+    do_not_optimize(set);
+  });
+}
+
+void bench_position(Bench &bench, const BenchPosition &position) {
+  const std::string &fen = position.fen;
+  const Board board = Board::from_fen(fen);
+  const auto legal_moves = Game::get_legal_moves(board);
+
+  bench.run("from_fen", position.name, [&] {
+    do_not_optimize(fen);
+    Board parsed = Board::from_fen(fen);
+    do_not_optimize(parsed);
+  });
+  bench.run("to_fen", position.name, [&] {
+    do_not_optimize(board);
+    std::string written = board.to_fen();
+    do_not_optimize(written);
+  });
+  bench.run("get_possible_moves", position.name, [&] {
+    do_not_optimize(board);
+    common::ArenaScope scope;
+    MoveList moves = make_move_list();
+    get_possible_moves(board, moves);
+    do_not_optimize(moves);
+  });
+  bench.run("get_legal_moves", position.name, [&] {
+    do_not_optimize(board);
+    common::ArenaScope scope;
+    MoveList moves = make_move_list();
+    Game::get_legal_moves(board, moves);
+    do_not_optimize(moves);
+  });
+  bench.run("is_in_check", position.name, [&] {
+    do_not_optimize(board);
+    bool check = is_in_check(board);
+    do_not_optimize(check);
+  });
+  bench.run("controlling_player, all colors", position.name, [&] {
+    do_not_optimize(board);
+    for (int color = 1; color < 13; color++) {
+      auto player = board.controlling_player(static_cast<Color>(color));
+      do_not_optimize(player);
+    }
+  });
+  if (!legal_moves.empty()) {
+    bench.run("make_move, all legal moves", position.name, [&] {
+      for (const Move &move : legal_moves) {
+        Board next = board;
+        next.make_move(move);
+        do_not_optimize(next);
+      }
+    });
+  }
+  bench.run("MinimaxBot::select_move", position.name, [&] {
+    Board copy = board;
+    MinimaxBot bot;
+    auto move = bot.select_move(copy);
+    do_not_optimize(move);
+  });
+}
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return {};
+    }
+    std::string value = argv[++i];
+    if (arg == "--json")
+      options.json = value;
+    else if (arg == "--min-time")
+      options.min_seconds = std::stod(value);
+    else if (arg == "--filter")
+      options.filter = value;
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      return {};
+    }
+  }
+  return options;
+}
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  Bench bench(*options);
+  bench_board_copy(bench);
+  bench_color_scan(bench);
+  for (const BenchPosition &position : kCorpus)
+    bench_position(bench, position);
+
+  if (!options->json.empty()) {
+    std::ofstream out(options->json);
+    bench.write_json(out);
+    if (!out) {
+      std::cerr << "Failed to write " << options->json << "\n";
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,173 @@
+#include "binary_position.h"
+
+#include <bit>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace sovereign_chess {
+
+namespace {
+constexpr std::size_t kBitmapOffset = 6;
+
+void write_u16(uint8_t *out, int value) {
+  out[0] = static_cast<uint8_t>(value & 0xff);
+  out[1] = static_cast<uint8_t>((value >> 8) & 0xff);
+}
+int read_u16(const uint8_t *in) { return in[0] | (in[1] << 8); }
+
+constexpr Castle kCastles[] = {Castle::Kingside, Castle::Queenside};
+constexpr Player kPlayers[] = {Player::Player1, Player::Player2};
+} // namespace
+
+std::size_t encode_position(const Board &board, uint8_t *out) {
+  uint8_t flags = board.player_to_move() == Player::Player2 ? 1 : 0;
+  int bit = 1;
+  for (Player player : kPlayers) {
+    for (Castle side : kCastles) {
+      if (board.castle_right(player, side))
+        flags |= 1 << bit;
+      bit++;
+    }
+  }
+  out[0] = flags;
+  out[1] = static_cast<uint8_t>(board.owned_color(Player::Player1)) |
+           static_cast<uint8_t>(board.owned_color(Player::Player2)) << 4;
+  write_u16(out + 2, board.halfmove_clock());
+  write_u16(out + 4, board.fullmove_number());
+
+  uint8_t *bitmap = out + kBitmapOffset;
+  std::memset(bitmap, 0, 32);
+  std::size_t size = kPositionHeaderSize;
+  for (int rank = 0; rank < 16; rank++) {
+    for (int file = 0; file < 16; file++) {
+      const Piece piece = board.piece_at({rank, file});
+      if (piece.color == Color::Empty)
+        continue;
+      int square = rank * 16 + file;
+      bitmap[square / 8] |= 1 << (square % 8);
+      out[size++] = static_cast<uint8_t>(piece.type) << 4 |
+                    static_cast<uint8_t>(piece.color);
+    }
+  }
+  return size;
+}
+
+std::size_t encoded_size(const uint8_t *data, std::size_t size) {
+  if (size < kPositionHeaderSize)
+    return 0;
+  std::size_t pieces = 0;
+  for (int i = 0; i < 32; i++)
+    pieces += std::popcount(data[kBitmapOffset + i]);
+  return kPositionHeaderSize + pieces;
+}
+
+std::size_t decode_position(const uint8_t *data, std::size_t size,
+                            Board &board) {
+  std::size_t record_size = encoded_size(data, size);
+  if (record_size == 0 || record_size > size)
+    return 0;
+
+  // Reject colors and types that no position has before touching board
+  const auto is_color = [](int color) { return color >= 1 && color <= 12; };
+  if (!is_color(data[1] & 0xf) || !is_color(data[1] >> 4))
+    return 0;
+  for (std::size_t i = kPositionHeaderSize; i < record_size; i++) {
+    const int type = data[i] >> 4;
+    if (!is_color(data[i] & 0xf) ||
+        type < static_cast<int>(PieceType::Pawn) ||
+        type > static_cast<int>(PieceType::King))
+      return 0;
+  }
+
+  uint8_t flags = data[0];
+  board.player_to_move() = flags & 1 ? Player::Player2 : Player::Player1;
+  int bit = 1;
+  for (Player player : kPlayers) {
+    for (Castle side : kCastles) {
+      board.castle_right(player, side) = flags & (1 << bit);
+      bit++;
+    }
+  }
+  board.owned_color(Player::Player1) = static_cast<Color>(data[1] & 0xf);
+  board.owned_color(Player::Player2) = static_cast<Color>(data[1] >> 4);
+  board.halfmove_clock() = read_u16(data + 2);
+  board.fullmove_number() = read_u16(data + 4);
+
+  const uint8_t *bitmap = data + kBitmapOffset;
+  const uint8_t *pieces = data + kPositionHeaderSize;
+  for (int rank = 0; rank < 16; rank++) {
+    for (int file = 0; file < 16; file++) {
+      int square = rank * 16 + file;
+      Piece piece{};
+      if (bitmap[square / 8] & (1 << (square % 8))) {
+        piece.type = static_cast<PieceType>(*pieces >> 4);
+        piece.color = static_cast<Color>(*pieces & 0xf);
+        pieces++;
+      }
+      board.place_piece(piece, {rank, file});
+    }
+  }
+  return record_size;
+}
+
+// ----------------------------- Position files ---------------------------
+
+PositionWriter::PositionWriter(std::ostream &out) : out_(out) {
+  char header[kPositionFileHeaderSize] = {};
+  std::memcpy(header, kPositionFileMagic, sizeof(kPositionFileMagic) - 1);
+  header[5] = kPositionFileVersion;
+  out_.write(header, sizeof(header));
+}
+
+void PositionWriter::write(const Board &board) {
+  uint8_t record[kMaxPositionSize];
+  std::size_t size = encode_position(board, record);
+  out_.write(reinterpret_cast<const char *>(record), size);
+  count_++;
+}
+
+PositionReader::PositionReader(const uint8_t *data, std::size_t size)
+    : data_(data), size_(size) {
+  valid_ = size >= kPositionFileHeaderSize &&
+           std::memcmp(data, kPositionFileMagic,
+                       sizeof(kPositionFileMagic) - 1) == 0 &&
+           data[5] == kPositionFileVersion;
+}
+
+bool PositionReader::next(Board &board) {
+  if (!valid_ || offset_ >= size_)
+    return false;
+  std::size_t consumed =
+      decode_position(data_ + offset_, size_ - offset_, board);
+  if (consumed == 0)
+    return false;
+  offset_ += consumed;
+  return true;
+}
+
+MappedFile::MappedFile(const std::string &path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    void *mapping =
+        mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, /*offset=*/0);
+    if (mapping != MAP_FAILED) {
+      data_ = static_cast<const uint8_t *>(mapping);
+      size_ = st.st_size;
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    munmap(const_cast<uint8_t *>(data_), size_);
+}
+
+} // namespace sovereign_chess
@@ -0,0 +1,91 @@
+// Compact binary encoding of sovereign chess positions, for bulk storage
+#pragma once
+#include <cstdint>
+
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+/** Position record layout, multi-byte fields little endian:
+ * - byte 0: flags. Bit 0 set if Player 2 is to move, bits 1-4 are castle
+ *   rights in the order KQkq
+ * - byte 1: owned colors, Player 1 in the low nibble and Player 2 in the high
+ * - bytes 2-3: halfmove clock
+ * - bytes 4-5: fullmove number
+ * - bytes 6-37: occupancy bitmap, bit (rank * 16 + file) set if occupied
+ * - one byte per occupied square, in bitmap order: type << 4 | color
+ */
+constexpr std::size_t kPositionHeaderSize = 38;
+constexpr std::size_t kMaxPositionSize = kPositionHeaderSize + 256;
+
+// Write board to out, which must have room for kMaxPositionSize bytes.
+// Returns the number of bytes written.
+std::size_t encode_position(const Board &board, uint8_t *out);
+
+// Size of the record starting at data, or 0 if fewer than
+// kPositionHeaderSize bytes are available
+std::size_t encoded_size(const uint8_t *data, std::size_t size);
+
+// Overwrite board with the record starting at data. Returns the number of
+// bytes consumed, or 0, leaving board as it was, if the record is truncated
+// or holds a color outside 1-12 or an invalid piece type.
+std::size_t decode_position(const uint8_t *data, std::size_t size,
+                            Board &board);
+
+/** Position files are an 8 byte header followed by back-to-back records.
+ */
+constexpr char kPositionFileMagic[6] = "SCPOS";
+constexpr uint8_t kPositionFileVersion = 1;
+constexpr std::size_t kPositionFileHeaderSize = 8;
+
+class PositionWriter {
+public:
+  explicit PositionWriter(std::ostream &out);
+
+  void write(const Board &board);
+  std::size_t count() const { return count_; }
+
+private:
+  std::ostream &out_;
+  std::size_t count_ = 0;
+};
+
+// Iterates over the records of a position file held in memory
+class PositionReader {
+public:
+  PositionReader(const uint8_t *data, std::size_t size);
+
+  // False if the file header is missing or has the wrong version
+  bool valid() const { return valid_; }
+
+  // Decode the next record into board. Returns false at end of file or on a
+  // truncated record.
+  bool next(Board &board);
+
+private:
+  const uint8_t *data_;
+  std::size_t size_;
+  std::size_t offset_ = kPositionFileHeaderSize;
+  bool valid_;
+};
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+  explicit MappedFile(const std::string &path);
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  bool is_open() const { return data_ != nullptr; }
+  const uint8_t *data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+  PositionReader positions() const { return PositionReader(data_, size_); }
+
+private:
+  const uint8_t *data_ = nullptr;
+  std::size_t size_ = 0;
+};
+
+} // namespace sovereign_chess
@@ -0,0 +1,137 @@
+// Builds an opening book by searching every position within a few plies of
+// the start, following the most visited moves of each search.
+//
+// Usage: book_builder OUTPUT [--plies N] [--width N] [--playouts N]
+//                     [--threads N] [--seed N]
+// Each position is searched with MCTS on one thread, and the positions of a
+// ply are spread across threads. The book move of a position is its most
+// visited move; the --width most visited moves lead to the next ply.
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+
+#include "generic_bots.h"
+#include "opening_book.h"
+#include "sovereign_chess.h"
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+struct Options {
+  std::string output;
+  int plies = 4;
+  int width = 3;
+  int playouts = 20000;
+  unsigned threads = common::ThreadPool::default_workers() + 1;
+  uint64_t seed = 0;
+};
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  if (argc < 2) {
+    std::cerr << "Usage: book_builder OUTPUT [--plies N] [--width N] "
+                 "[--playouts N] [--threads N] [--seed N]\n";
+    return {};
+  }
+  Options options;
+  options.output = argv[1];
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return {};
+    }
+    std::string value = argv[++i];
+    if (arg == "--plies")
+      options.plies = std::stoi(value);
+    else if (arg == "--width")
+      options.width = std::stoi(value);
+    else if (arg == "--playouts")
+      options.playouts = std::stoi(value);
+    else if (arg == "--threads")
+      options.threads = std::stoi(value);
+    else if (arg == "--seed")
+      options.seed = std::stoull(value);
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      return {};
+    }
+  }
+  return options;
+}
+
+struct SearchResult {
+  BookEntry entry;
+  std::vector<Board> children; // after the most visited moves
+};
+
+SearchResult search(const Board &board, const Options &options,
+                    uint64_t seed) {
+  MctsOptions mcts;
+  mcts.playouts = options.playouts;
+  mcts.seed = seed;
+  MctsBot bot(mcts);
+  Board root = board;
+  SearchResult result;
+  result.entry.hash = board.hash();
+  auto move = bot.select_move(root);
+  if (!move)
+    return result;
+
+  const auto &visits = bot.last_root_visits();
+  result.entry.move = pack_move(*move);
+  result.entry.score =
+      static_cast<int32_t>(visits.front().second * 1000 / options.playouts);
+  for (std::size_t i = 0; i < visits.size() && int(i) < options.width; i++) {
+    Board child = board;
+    child.make_move(unpack_move(visits[i].first));
+    result.children.push_back(child);
+  }
+  return result;
+}
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  common::ThreadPool pool(std::max(options->threads, 1u) - 1);
+  const auto start = std::chrono::steady_clock::now();
+
+  std::vector<BookEntry> entries;
+  std::vector<Board> ply_positions = {Board::from_fen(kInitialFen)};
+  std::unordered_set<uint64_t> seen = {ply_positions.front().hash()};
+  for (int ply = 0; ply < options->plies && !ply_positions.empty(); ply++) {
+    std::vector<SearchResult> results(ply_positions.size());
+    pool.parallel_for(ply_positions.size(), [&](std::size_t i) {
+      results[i] = search(ply_positions[i], *options,
+                          options->seed + entries.size() + i);
+    });
+
+    std::vector<Board> next;
+    for (auto &result : results) {
+      if (result.entry.move == 0) // game over
+        continue;
+      entries.push_back(result.entry);
+      for (const Board &child : result.children) {
+        if (seen.insert(child.hash()).second)
+          next.push_back(child);
+      }
+    }
+    std::cout << "Ply " << ply << ": " << ply_positions.size()
+              << " positions" << std::endl;
+    ply_positions = std::move(next);
+  }
+
+  std::ofstream out(options->output, std::ios::binary);
+  write_book(out, entries);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << "Wrote " << entries.size() << " positions to "
+            << options->output << " in " << elapsed.count() << "s\n";
+  return out ? 0 : 1;
+}
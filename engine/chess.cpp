@@ -453,4 +453,18 @@ std::vector<Move> Game::get_legal_moves(const Board &board) {
   return moves;
 }
 
+int Game::material_balance(const Board &board) {
+  int balance = 0;
+  for (int rank = 0; rank < 8; rank++) {
+    for (int file = 0; file < 8; file++) {
+      const Color color = board.piece_at({rank, file}).color;
+      if (color == board.side_to_move())
+        balance++;
+      else if (color == board.not_side_to_move())
+        balance--;
+    }
+  }
+  return balance;
+}
+
 } // namespace chess
\ No newline at end of file
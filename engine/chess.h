@@ -210,8 +210,18 @@ void prettyprint_move(const Board &board, const Move &move);
 
 std::vector<Move> get_possible_moves(const Board &board);
 
+// Adapter for common::Game
 struct Game {
-  using Board = Board;
+  using Board = chess::Board;
+  using Move = chess::Move;
+  using MoveList = std::vector<Move>;
   static std::vector<Move> get_legal_moves(const Board &board);
+  static void get_legal_moves(const Board &board, MoveList &moves) {
+    moves = get_legal_moves(board);
+  }
+  static bool is_in_check(const Board &board) {
+    return chess::is_in_check(board);
+  }
+  static int material_balance(const Board &board);
 };
 } // namespace chess
\ No newline at end of file
@@ -0,0 +1,71 @@
+// Compile-time interface shared by the chess and sovereign chess engines, and
+// code written once against it
+#pragma once
+#include <concepts>
+#include <cstdint>
+
+#include "arena.h"
+
+namespace common {
+
+/** A game adapter: a struct naming the Board, Move and MoveList types of an
+ * engine, with static functions for the rules generic code needs. Boards are
+ * values, copied before each move. MoveList is a vector, possibly backed by
+ * the thread's arena, so callers open an ArenaScope around it.
+ */
+template <typename G>
+concept Game = requires(const typename G::Board &board,
+                        typename G::Board &next, const typename G::Move &move,
+                        typename G::MoveList &moves) {
+  G::get_legal_moves(board, moves); // into an empty list
+  { G::is_in_check(board) } -> std::convertible_to<bool>;
+  // Pieces of the player to move less the opponent's
+  { G::material_balance(board) } -> std::convertible_to<int>;
+  next.make_move(move);
+};
+
+template <Game G> typename G::MoveList make_move_list() {
+  typename G::MoveList moves;
+  moves.reserve(256);
+  return moves;
+}
+
+// Positions along a game, for games without repetition detection
+template <typename Board> struct NoHistory {
+  void push(const Board &) {}
+  void pop() {}
+  int repetitions() const { return 0; }
+};
+
+// G::History if the game has one, otherwise NoHistory
+template <typename G> struct HistoryOf {
+  using type = NoHistory<typename G::Board>;
+};
+template <typename G>
+  requires requires { typename G::History; }
+struct HistoryOf<G> {
+  using type = typename G::History;
+};
+template <typename G> using History = typename HistoryOf<G>::type;
+
+// Number of positions reachable from board in exactly depth plies
+template <Game G> uint64_t perft(const typename G::Board &board, int depth) {
+  if (depth == 0)
+    return 1;
+
+  ArenaScope scope;
+  typename G::MoveList legal_moves = make_move_list<G>();
+  G::get_legal_moves(board, legal_moves);
+  if (depth == 1)
+    return legal_moves.size();
+
+  uint64_t nodes = 0;
+  for (const auto &move : legal_moves) {
+    typename G::Board new_board = board;
+    new_board.make_move(move);
+    nodes += perft<G>(new_board, depth - 1);
+  }
+  return nodes;
+}
+
+} // namespace common
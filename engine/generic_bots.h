@@ -1,38 +1,104 @@
-// Bots for generic game playing
+// Bots for generic game playing. The random and minimax bots play any
+// common::Game; the rest are specific to sovereign chess.
 #pragma once
-#include <cstdlib>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
 
+#include "game.h"
+#include "position_history.h"
+#include "profile.h"
+#include "rng.h"
 #include "sovereign_chess.h"
+#include "tablebase.h"
+#include "thread_pool.h"
 
 namespace sovereign_chess {
 
-class RandomBot {
+template <common::Game G> class BasicRandomBot {
 public:
-  std::optional<Move> select_move(Board &board) {
-    auto legal_moves = Game::get_legal_moves(board);
+  explicit BasicRandomBot(uint64_t seed = 0) : rng_(seed) {}
+
+  std::optional<typename G::Move> select_move(typename G::Board &board) {
+    common::ArenaScope scope;
+    typename G::MoveList legal_moves = common::make_move_list<G>();
+    G::get_legal_moves(board, legal_moves);
     if (legal_moves.empty()) {
       return {};
     }
-    return legal_moves[rand() % legal_moves.size()];
+    return legal_moves[rng_.below(legal_moves.size())];
   }
+
+private:
+  common::Rng rng_;
 };
+using RandomBot = BasicRandomBot<Game>;
 
-class MinimaxBot {
+// Play uniformly random legal moves from board until the game ends or
+// max_plies have been played. Returns the winner, or empty for a draw or an
+// unfinished game. history holds the line leading to board, ending with it;
+// the game is drawn if a position occurs three times, and history is restored
+// before returning.
+inline std::optional<Player> random_playout(Board board, common::Rng &rng,
+                                            int max_plies,
+                                            PositionHistory &history) {
+  const std::size_t history_size = history.size();
+  std::optional<Player> winner;
+  for (int ply = 0; ply < max_plies && !history.is_threefold(); ply++) {
+    common::ArenaScope scope;
+    MoveList legal_moves = make_move_list();
+    Game::get_legal_moves(board, legal_moves);
+    if (legal_moves.empty()) {
+      if (is_in_check(board))
+        winner = other_player(board.player_to_move());
+      break;
+    }
+    board.make_move(legal_moves[rng.below(legal_moves.size())]);
+    history.push(board);
+  }
+  history.truncate(history_size);
+  return winner;
+}
+
+inline std::optional<Player> random_playout(const Board &board,
+                                            common::Rng &rng, int max_plies) {
+  PositionHistory history;
+  history.push(board);
+  return random_playout(board, rng, max_plies, history);
+}
+
+template <common::Game G> class BasicMinimaxBot {
 public:
-  std::optional<Move> select_move(Board &board) {
+  using Board = typename G::Board;
+  using Move = typename G::Move;
+  using History = common::History<G>;
+
+  // Positions in the tablebases, if given, score exactly without searching
+  explicit BasicMinimaxBot(const Tablebases *tablebases = nullptr)
+      : tablebases_(tablebases) {}
+
+  // history holds the game so far, ending with board. Positions that repeat
+  // one from earlier in the game or search line score as draws.
+  std::optional<Move> select_move(Board &board, const History &history = {}) {
     const int kDepth = 1;
-    auto legal_moves = Game::get_legal_moves(board);
+    common::ArenaScope scope;
+    typename G::MoveList legal_moves = common::make_move_list<G>();
+    G::get_legal_moves(board, legal_moves);
 
     if (legal_moves.empty()) {
       return {};
     }
+    history_ = history;
 
     double max_score = -std::numeric_limits<double>::infinity();
     Move best_move = legal_moves.front();
     for (const auto &move : legal_moves) {
       Board new_board = board;
       new_board.make_move(move);
-      const double score = -negaMax(new_board, kDepth - 1);
+      const double score = -search_child(new_board, kDepth - 1);
 
       if (score > max_score) {
         max_score = score;
@@ -43,11 +109,23 @@ public:
   }
 
 private:
+  double search_child(const Board &board, int depth) {
+    history_.push(board);
+    const double score =
+        history_.repetitions() > 0 ? 0 : negaMax(board, depth);
+    history_.pop();
+    return score;
+  }
+
   double negaMax(const Board &board, int depth) {
+    if (auto score = tablebase_score(board))
+      return *score;
     if (depth == 0)
       return evaluate(board);
 
-    auto legal_moves = Game::get_legal_moves(board);
+    common::ArenaScope scope;
+    typename G::MoveList legal_moves = common::make_move_list<G>();
+    G::get_legal_moves(board, legal_moves);
     if (legal_moves.empty())
       return evaluate(board);
 
@@ -56,42 +134,336 @@ private:
     for (const auto &move : legal_moves) {
       Board new_board = board;
       new_board.make_move(move);
-      const double score = -negaMax(new_board, depth - 1);
+      const double score = -search_child(new_board, depth - 1);
 
       max_score = std::max(max_score, score);
     }
     return max_score;
   }
 
-  // Relative to Player 1
+  // Relative to the player to move
   double evaluate(const Board &board) const {
-    auto legal_moves = Game::get_legal_moves(board);
+    PROFILE_SCOPE("evaluate");
+    common::ArenaScope scope;
+    typename G::MoveList legal_moves = common::make_move_list<G>();
+    G::get_legal_moves(board, legal_moves);
 
-    double score = 0;          // score relative to active player
     if (legal_moves.empty()) { // game over
-      if (is_in_check(board))  // checkmate
+      if (G::is_in_check(board)) // checkmate
         return -std::numeric_limits<double>::infinity();
       else // stalemate
         return 0;
     }
 
     // Otherwise, count up pieces
-    int self_piece_count = 0;
-    int other_piece_count = 0;
-    for (int row = 0; row < 16; row++) {
-      for (int col = 0; col < 16; col++) {
-        std::optional<Player> player =
-            board.controlling_player(board.piece_at(Coord{row, col}).color);
-        if (!player)
-          continue;
-        else if (*player == board.player_to_move())
-          self_piece_count++;
+    return G::material_balance(board);
+  }
+
+  // Relative to the player to move; mates found sooner score further from 0
+  std::optional<double> tablebase_score(const Board &board) const {
+    if constexpr (std::is_same_v<G, Game>) {
+      if (!tablebases_)
+        return {};
+      auto result = tablebases_->probe(board);
+      if (!result)
+        return {};
+      return result->outcome * (kTablebaseWin - result->plies);
+    }
+    return {};
+  }
+
+  static constexpr double kTablebaseWin = 1e6;
+
+  History history_; // Game and search line, for repetitions
+  const Tablebases *tablebases_; // Sovereign chess only
+};
+using MinimaxBot = BasicMinimaxBot<Game>;
+
+/** Monte Carlo tree search with UCT selection and random playouts.
+ *
+ * Nodes live in a fixed-size pool and are addressed by index; the children of
+ * a node are allocated as one contiguous block when it is expanded. With
+ * several threads the search either shares one tree, using virtual loss to
+ * spread threads across branches (tree parallelism), or gives each thread its
+ * own tree and sums root visits at the end (root parallelism). The tree is
+ * kept between moves and re-rooted at the position the next search starts
+ * from, until the pool fills up.
+ */
+struct MctsOptions {
+  enum class Parallelism { Tree, Root };
+
+  int playouts = 1000;          // per move, across all threads
+  double max_seconds = 0;       // per move, 0 for no limit
+  int threads = 1;
+  Parallelism parallelism = Parallelism::Tree;
+  double exploration = 1.4;     // UCT exploration constant
+  int virtual_loss = 3;         // visits counted as losses while in flight
+  int rollout_plies = 100;      // playouts that run longer count as draws
+  std::size_t max_nodes = 1 << 18; // per tree
+  uint64_t seed = 0;
+};
+
+class MctsTree {
+public:
+  static constexpr uint32_t kNone = std::numeric_limits<uint32_t>::max();
+
+  enum class State : uint8_t { Unexpanded, Expanding, Expanded, Full };
+
+  struct Node {
+    PackedMove move = 0; // move leading to this node
+    Player mover = Player::Player1; // player who made that move
+    std::atomic<State> state = State::Unexpanded;
+    uint32_t first_child = kNone;
+    uint32_t num_children = 0;
+    std::atomic<int32_t> visits = 0;
+    std::atomic<int64_t> score = 0; // 2 per win for mover, 1 per draw
+  };
+
+  explicit MctsTree(std::size_t max_nodes)
+      : nodes_(std::make_unique<Node[]>(max_nodes)), capacity_(max_nodes) {}
+
+  // Start a search from board, reusing the subtree of the current root if
+  // board is reachable from it in one or two plies.
+  void set_root(const Board &board) {
+    if (root_board_ && size_ * 10 < capacity_ * 9) {
+      if (*root_board_ == board)
+        return;
+      if (advance_root(board))
+        return;
+    }
+    size_ = 0;
+    root_ = allocate(1);
+    init_node(root_, 0, other_player(board.player_to_move()));
+    root_board_ = board;
+  }
+
+  // Run one playout: select down the tree, expand a leaf, play randomly to
+  // the end and back up the result. line holds the game up to the root and is
+  // restored afterwards.
+  void playout(const MctsOptions &options, common::Rng &rng,
+               std::vector<uint32_t> &path, PositionHistory &line) {
+    Board board = *root_board_;
+    const std::size_t line_size = line.size();
+    path.clear();
+    uint32_t index = root_;
+    while (true) {
+      Node &node = nodes_[index];
+      path.push_back(index);
+      node.visits += options.virtual_loss;
+
+      State state = node.state.load(std::memory_order_acquire);
+      if (state == State::Unexpanded)
+        state = expand(node, board);
+      if (state != State::Expanded || node.num_children == 0)
+        break;
+
+      index = select_child(node, options.exploration);
+      board.make_move(unpack_move(nodes_[index].move));
+      line.push(board);
+    }
+
+    std::optional<Player> winner =
+        random_playout(board, rng, options.rollout_plies, line);
+    line.truncate(line_size);
+    for (uint32_t i : path) {
+      Node &node = nodes_[i];
+      node.visits += 1 - options.virtual_loss;
+      if (!winner)
+        node.score += 1;
+      else if (*winner == node.mover)
+        node.score += 2;
+    }
+  }
+
+  const Node &root() const { return nodes_[root_]; }
+  const Node &node(uint32_t index) const { return nodes_[index]; }
+  std::size_t size() const { return size_; }
+
+private:
+  uint32_t allocate(uint32_t count) {
+    std::size_t first = size_.fetch_add(count);
+    if (first + count > capacity_)
+      return kNone;
+    return first;
+  }
+
+  void init_node(uint32_t index, PackedMove move, Player mover) {
+    Node &node = nodes_[index];
+    node.move = move;
+    node.mover = mover;
+    node.first_child = kNone;
+    node.num_children = 0;
+    node.visits = 0;
+    node.score = 0;
+    node.state.store(State::Unexpanded, std::memory_order_release);
+  }
+
+  // Returns the node's state after trying to expand it. Only one thread
+  // expands a node; the others treat it as a leaf until it is done.
+  State expand(Node &node, const Board &board) {
+    State expected = State::Unexpanded;
+    if (!node.state.compare_exchange_strong(expected, State::Expanding))
+      return expected;
+
+    common::ArenaScope scope;
+    MoveList legal_moves = make_move_list();
+    Game::get_legal_moves(board, legal_moves);
+    uint32_t first = allocate(legal_moves.size());
+    if (first == kNone) {
+      node.state.store(State::Full, std::memory_order_release);
+      return State::Full;
+    }
+    for (std::size_t i = 0; i < legal_moves.size(); i++)
+      init_node(first + i, pack_move(legal_moves[i]), board.player_to_move());
+    node.first_child = first;
+    node.num_children = legal_moves.size();
+    node.state.store(State::Expanded, std::memory_order_release);
+    return State::Expanded;
+  }
+
+  uint32_t select_child(const Node &node, double exploration) const {
+    const double log_parent = std::log(std::max(1, node.visits.load()));
+    uint32_t best = node.first_child;
+    double best_value = -std::numeric_limits<double>::infinity();
+    for (uint32_t i = 0; i < node.num_children; i++) {
+      const Node &child = nodes_[node.first_child + i];
+      const int visits = child.visits.load(std::memory_order_relaxed);
+      if (visits == 0)
+        return node.first_child + i;
+      const double value = child.score.load(std::memory_order_relaxed) /
+                                (2.0 * visits) +
+                            exploration * std::sqrt(log_parent / visits);
+      if (value > best_value) {
+        best_value = value;
+        best = node.first_child + i;
+      }
+    }
+    return best;
+  }
+
+  bool advance_root(const Board &board) {
+    const Node &root = nodes_[root_];
+    if (root.state != State::Expanded)
+      return false;
+    for (uint32_t i = 0; i < root.num_children; i++) {
+      const uint32_t child_index = root.first_child + i;
+      const Node &child = nodes_[child_index];
+      Board child_board = *root_board_;
+      child_board.make_move(unpack_move(child.move));
+      if (child_board == board) {
+        root_ = child_index;
+        root_board_ = child_board;
+        return true;
+      }
+      if (child.state != State::Expanded)
+        continue;
+      for (uint32_t j = 0; j < child.num_children; j++) {
+        const uint32_t grandchild_index = child.first_child + j;
+        Board grandchild_board = child_board;
+        grandchild_board.make_move(unpack_move(nodes_[grandchild_index].move));
+        if (grandchild_board == board) {
+          root_ = grandchild_index;
+          root_board_ = grandchild_board;
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  std::unique_ptr<Node[]> nodes_;
+  std::size_t capacity_;
+  std::atomic<std::size_t> size_ = 0;
+  uint32_t root_ = 0;
+  std::optional<Board> root_board_;
+};
+
+class MctsBot {
+public:
+  explicit MctsBot(MctsOptions options = {})
+      : options_(options),
+        pool_(std::make_unique<common::ThreadPool>(
+            std::max(options.threads, 1) - 1)) {}
+
+  // history holds the game so far, ending with board
+  std::optional<Move> select_move(Board &board,
+                                  const PositionHistory &history = {}) {
+    if (Game::get_legal_moves(board).empty())
+      return {};
+
+    const std::size_t num_trees =
+        options_.parallelism == MctsOptions::Parallelism::Root
+            ? options_.threads
+            : 1;
+    while (trees_.size() < num_trees)
+      trees_.push_back(std::make_unique<MctsTree>(options_.max_nodes));
+    for (auto &tree : trees_)
+      tree->set_root(board);
+
+    const auto start = std::chrono::steady_clock::now();
+    std::atomic<int> started = 0;
+    pool_->parallel_for(options_.threads, [&](std::size_t thread) {
+      MctsTree &tree = *trees_[thread % num_trees];
+      common::Rng rng(options_.seed ^ (searches_ << 16) ^ thread);
+      std::vector<uint32_t> path;
+      PositionHistory line = history;
+      if (line.empty())
+        line.push(board);
+      while (started++ < options_.playouts) {
+        tree.playout(options_, rng, path, line);
+        if (options_.max_seconds > 0 &&
+            std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                          start)
+                    .count() > options_.max_seconds)
+          break;
+      }
+    });
+    searches_++;
+    last_playouts_ = std::min(started.load(), options_.playouts);
+    last_seconds_ =
+        std::chrono::duration<double>(std::chrono::steady_clock::now() - start)
+            .count();
+
+    // Most visited root move, summed across trees
+    std::vector<std::pair<PackedMove, int64_t>> &visits = last_root_visits_;
+    visits.clear();
+    for (const auto &tree : trees_) {
+      const auto &root = tree->root();
+      for (uint32_t i = 0; i < root.num_children; i++) {
+        const auto &child = tree->node(root.first_child + i);
+        auto it = std::find_if(visits.begin(), visits.end(), [&](auto &entry) {
+          return entry.first == child.move;
+        });
+        if (it == visits.end())
+          visits.emplace_back(child.move, child.visits.load());
         else
-          other_piece_count++;
+          it->second += child.visits;
       }
     }
+    if (visits.empty()) // out of nodes before the root could be expanded
+      return Game::get_legal_moves(board).front();
+    std::stable_sort(visits.begin(), visits.end(), [](auto &a, auto &b) {
+      return a.second > b.second;
+    });
+    return unpack_move(visits.front().first);
+  }
 
-    return (self_piece_count - other_piece_count);
+  // Statistics of the most recent search
+  int last_playouts() const { return last_playouts_; }
+  double last_seconds() const { return last_seconds_; }
+  // Root moves and their visits, most visited first
+  const std::vector<std::pair<PackedMove, int64_t>> &last_root_visits() const {
+    return last_root_visits_;
   }
+
+private:
+  MctsOptions options_;
+  std::unique_ptr<common::ThreadPool> pool_;
+  std::vector<std::unique_ptr<MctsTree>> trees_;
+  uint64_t searches_ = 0;
+  int last_playouts_ = 0;
+  double last_seconds_ = 0;
+  std::vector<std::pair<PackedMove, int64_t>> last_root_visits_;
 };
-} // namespace sovereign_chess
\ No newline at end of file
+
+} // namespace sovereign_chess
@@ -5,7 +5,13 @@
 
 #include <emscripten/emscripten.h>
 
+#include "batch.h"
+#include "binary_position.h"
 #include "generic_bots.h"
+#include "lru_cache.h"
+#include "opening_book.h"
+#include "position_history.h"
+#include "search.h"
 #include "sovereign_chess.h"
 
 namespace {
@@ -16,31 +22,187 @@ char *to_new_cstr(const std::string str) {
 
 namespace sovereign_chess {
 
-std::string get_legal_moves_impl(std::string_view fen) {
-  std::cout << fen << std::endl;
+common::ThreadPool &thread_pool() {
+  static common::ThreadPool pool;
+  return pool;
+}
 
+/** Answers to per-position queries, which the UI repeats for the same
+ * position on every render. Keyed by the position hash combined with a key
+ * for the query, the way Board::hash combines features. Only used from the
+ * main thread.
+ */
+enum class Query { LegalMoves, OwnedColor, ControlledColors };
+common::LruCache<uint64_t, std::string> &query_cache() {
+  static common::LruCache<uint64_t, std::string> cache(1024);
+  return cache;
+}
+
+template <typename Compute>
+std::string cached_query(const Board &board, Query query, bool active_player,
+                         Compute &&compute) {
+  const uint64_t key =
+      board.hash() ^
+      hash_key(1 << 17 | static_cast<int>(query) << 1 | active_player);
+  return query_cache().find_or_insert(key, compute);
+}
+
+std::string get_legal_moves_impl(std::string_view fen) {
   const typename Game::Board board = Game::Board::from_fen(fen);
 
-  auto legal_moves = Game::get_legal_moves(board);
+  return cached_query(board, Query::LegalMoves, true, [&] {
+    auto legal_moves = Game::get_legal_moves(board);
+    std::ostringstream ss;
+    for (int i = 0; i < legal_moves.size(); i++) {
+      ss << legal_moves[i].to_string();
+      if (i < legal_moves.size() - 1)
+        ss << " ";
+    }
+    return ss.str();
+  });
+}
+
+std::string get_owned_color_impl(std::string_view fen, bool active_player) {
+  Board board = Game::Board::from_fen(fen);
+
+  return cached_query(board, Query::OwnedColor, active_player, [&] {
+    Player player = active_player ? board.player_to_move()
+                                  : other_player(board.player_to_move());
+    return std::string{color_names.at(board.owned_color(player))};
+  });
+}
+
+std::string get_controlled_colors_impl(std::string_view fen,
+                                       bool active_player) {
+  Board board = Board::from_fen(fen);
+
+  return cached_query(board, Query::ControlledColors, active_player, [&] {
+    Player player = active_player ? board.player_to_move()
+                                  : other_player(board.player_to_move());
+
+    std::ostringstream ss;
+    for (const auto &[color, name] : color_names) {
+      if (board.controlling_player(color) == player &&
+          color != board.owned_color(player)) {
+        if (!ss.str().empty())
+          ss << " ";
+        ss << name;
+      }
+    }
+    return ss.str();
+  });
+}
+
+// Hits, misses and entries of the query cache, space-separated
+std::string get_cache_stats_impl() {
+  const auto &cache = query_cache();
   std::ostringstream ss;
-  for (int i = 0; i < legal_moves.size(); i++) {
-    ss << legal_moves[i].to_string();
-    if (i < legal_moves.size() - 1)
-      ss << " ";
+  ss << cache.hits() << " " << cache.misses() << " " << cache.size();
+  return ss.str();
+}
+
+std::vector<std::string_view> split_lines(std::string_view text) {
+  std::vector<std::string_view> lines;
+  while (!text.empty()) {
+    std::size_t end = std::min(text.find('\n'), text.size());
+    lines.push_back(text.substr(0, end));
+    text.remove_prefix(std::min(end + 1, text.size()));
+  }
+  return lines;
+}
+
+std::string get_legal_moves_batch_impl(std::string_view fens) {
+  std::vector<std::string_view> fen_list = split_lines(fens);
+
+  std::vector<PackedMove> moves(fen_list.size() * kMaxMovesPerPosition);
+  std::vector<uint32_t> counts(fen_list.size());
+  get_legal_moves_batch(fen_list, {moves.data(), counts.data()},
+                        thread_pool());
+
+  std::ostringstream ss;
+  for (std::size_t i = 0; i < fen_list.size(); i++) {
+    const PackedMove *position_moves = &moves[i * kMaxMovesPerPosition];
+    // Only the first kMaxMovesPerPosition moves were written
+    const std::size_t written =
+        std::min<std::size_t>(counts[i], kMaxMovesPerPosition);
+    if (written < counts[i])
+      std::cerr << "get_legal_moves_batch: position " << i << " has "
+                << counts[i] << " legal moves, listing the first " << written
+                << std::endl;
+    for (std::size_t j = 0; j < written; j++) {
+      if (j > 0)
+        ss << " ";
+      ss << unpack_move(position_moves[j]).to_string();
+    }
+    if (i < fen_list.size() - 1)
+      ss << "\n";
   }
   return ss.str();
 }
 
+// fens is the game so far, one position per line, ending with the current one
+std::string get_game_state_impl(std::string_view fens) {
+  std::vector<std::string_view> fen_list = split_lines(fens);
+  if (fen_list.empty())
+    return "";
+
+  PositionHistory history;
+  Board board;
+  for (std::string_view fen : fen_list) {
+    board = Board::from_fen(fen);
+    history.push(board);
+  }
+
+  if (Game::get_legal_moves(board).empty())
+    return is_in_check(board) ? "checkmate" : "stalemate";
+  if (history.is_threefold())
+    return "repetition";
+  return "ongoing";
+}
+
+// Book built by book_builder, embedded at /book.bin when the module is built
+// with BOOK set. Invalid (and empty) if there is none.
+const OpeningBook &opening_book() {
+  static const MappedFile file("/book.bin");
+  static const OpeningBook book(file.data(), file.size());
+  return book;
+}
+
+// Kept between calls so that it can ponder on the user's time
+AlphaBetaBot &search_bot() {
+  static AlphaBetaBot bot({.depth = 3, .seconds = 2});
+  return bot;
+}
+
 std::string select_move_impl(std::string_view fen) {
   Board board = Board::from_fen(fen);
+  if (opening_book().valid()) {
+    if (auto move = opening_book().lookup(board))
+      return move->to_string();
+  }
 
-  MinimaxBot bot;
-  auto move = bot.select_move(board);
+  auto move = search_bot().select_move(board);
   if (!move)
     return "";
   return move->to_string();
 }
 
+// Nodes per ponder_step, a few milliseconds of search, so that stepping
+// between events on the main thread doesn't hold up the page
+constexpr uint64_t kPonderStepNodes = 2000;
+
+// Pondering runs on a thread where the module has them; otherwise the caller
+// steps it. Returns whether stepping is needed.
+bool start_pondering_impl(std::string_view fen) {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+  search_bot().ponder(Board::from_fen(fen), {}, false);
+  return true;
+#else
+  search_bot().ponder(Board::from_fen(fen));
+  return false;
+#endif
+}
+
 std::string make_move_impl(std::string_view fen, std::string_view move_str) {
   Board board = Game::Board::from_fen(fen);
 
@@ -57,11 +219,46 @@ const char *EMSCRIPTEN_KEEPALIVE get_legal_moves(const char *fen) {
   return to_new_cstr(sovereign_chess::get_legal_moves_impl(fen));
 }
 
+// For newline-separated fens, produce newline-separated lists of legal moves,
+// at most kMaxMovesPerPosition per position
+const char *EMSCRIPTEN_KEEPALIVE get_legal_moves_batch(const char *fens) {
+  return to_new_cstr(sovereign_chess::get_legal_moves_batch_impl(fens));
+}
+
+// For count binary position records, write packed legal moves into
+// caller-allocated buffers laid out as described by BatchOutput
+void EMSCRIPTEN_KEEPALIVE get_legal_moves_batch_binary(const uint8_t *records,
+                                                       int size, int count,
+                                                       uint32_t *moves,
+                                                       uint32_t *counts) {
+  sovereign_chess::get_legal_moves_batch(records, size, count, {moves, counts},
+                                         sovereign_chess::thread_pool());
+}
+
+// For newline-separated fens of a game so far, return "ongoing",
+// "checkmate", "stalemate" or "repetition"
+const char *EMSCRIPTEN_KEEPALIVE get_game_state(const char *fens) {
+  return to_new_cstr(sovereign_chess::get_game_state_impl(fens));
+}
+
 // For a given fen, return a move and new fen, comma-separated
 const char *EMSCRIPTEN_KEEPALIVE select_move(const char *fen) {
   return to_new_cstr(sovereign_chess::select_move_impl(fen));
 }
 
+// Search the replies to fen, the position after select_move's move, until the
+// next select_move. Returns true if ponder_step must be called to make
+// progress, as in builds without threads.
+bool EMSCRIPTEN_KEEPALIVE start_pondering(const char *fen) {
+  return sovereign_chess::start_pondering_impl(fen);
+}
+
+// Search a few milliseconds more; returns false once every reply is searched
+bool EMSCRIPTEN_KEEPALIVE ponder_step() {
+  return sovereign_chess::search_bot().ponder_step(
+      sovereign_chess::kPonderStepNodes);
+}
+
 // For a given fen, return a move and new fen, comma-separated
 const char *EMSCRIPTEN_KEEPALIVE make_move(const char *fen, const char *move) {
   return to_new_cstr(sovereign_chess::make_move_impl(fen, move));
@@ -69,36 +266,19 @@ const char *EMSCRIPTEN_KEEPALIVE make_move(const char *fen, const char *move) {
 
 const char *EMSCRIPTEN_KEEPALIVE get_owned_color(const char *fen,
                                                  bool activePlayer) {
-  using namespace sovereign_chess;
-  Board board = Game::Board::from_fen(fen);
-
-  Player player = activePlayer ? board.player_to_move()
-                               : other_player(board.player_to_move());
-
-  Color owned_color = board.owned_color(player);
-  std::string color_name{color_names.at(owned_color)};
-  return to_new_cstr(color_name);
+  return to_new_cstr(sovereign_chess::get_owned_color_impl(fen, activePlayer));
 }
 
 // Get colors controlled (but not owned) by a player
 const char *EMSCRIPTEN_KEEPALIVE get_controlled_colors(const char *fen,
                                                        bool activePlayer) {
-  using namespace sovereign_chess;
-  Board board = Board::from_fen(fen);
-
-  Player player = activePlayer ? board.player_to_move()
-                               : other_player(board.player_to_move());
-
-  std::ostringstream ss;
-  for (const auto &[color, name] : color_names) {
-    if (board.controlling_player(color) == player &&
-        color != board.owned_color(player)) {
-      if (!ss.str().empty())
-        ss << " ";
-      ss << name;
-    }
-  }
+  return to_new_cstr(
+      sovereign_chess::get_controlled_colors_impl(fen, activePlayer));
+}
 
-  return to_new_cstr(ss.str());
+// Hits, misses and entries of the cache behind get_legal_moves,
+// get_owned_color and get_controlled_colors, space-separated
+const char *EMSCRIPTEN_KEEPALIVE get_cache_stats() {
+  return to_new_cstr(sovereign_chess::get_cache_stats_impl());
 }
 }
\ No newline at end of file
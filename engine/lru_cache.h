@@ -0,0 +1,77 @@
+// Bounded cache that evicts the least recently used entry
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <utility>
+
+namespace common {
+
+/** Entries are kept in a list from most to least recently used, indexed by a
+ * hash map, so lookups, inserts and evictions are all O(1). Lookups count
+ * hits and misses, for tuning the capacity.
+ */
+template <typename Key, typename Value> class LruCache {
+public:
+  explicit LruCache(std::size_t capacity) : capacity_(capacity) {}
+
+  // The value for key, now the most recently used, or null on a miss. The
+  // pointer is valid until the next insert.
+  Value *find(const Key &key) {
+    auto it = index_.find(key);
+    if (it == index_.end()) {
+      misses_++;
+      return nullptr;
+    }
+    hits_++;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return &it->second->second;
+  }
+
+  // Adds or replaces the value for key, evicting the least recently used
+  // entry if the cache is full
+  Value &insert(const Key &key, Value value) {
+    auto it = index_.find(key);
+    if (it != index_.end()) {
+      entries_.splice(entries_.begin(), entries_, it->second);
+      it->second->second = std::move(value);
+      return it->second->second;
+    }
+    if (entries_.size() >= capacity_ && !entries_.empty()) {
+      index_.erase(entries_.back().first);
+      entries_.pop_back();
+    }
+    entries_.emplace_front(key, std::move(value));
+    index_.emplace(key, entries_.begin());
+    return entries_.front().second;
+  }
+
+  // find, or insert the result of compute() on a miss
+  template <typename Compute>
+  Value &find_or_insert(const Key &key, Compute &&compute) {
+    if (Value *value = find(key))
+      return *value;
+    return insert(key, compute());
+  }
+
+  void clear() {
+    entries_.clear();
+    index_.clear();
+  }
+
+  std::size_t size() const { return entries_.size(); }
+  std::size_t capacity() const { return capacity_; }
+  uint64_t hits() const { return hits_; }
+  uint64_t misses() const { return misses_; }
+
+private:
+  using Entries = std::list<std::pair<Key, Value>>;
+  std::size_t capacity_;
+  Entries entries_; // most recently used first
+  std::unordered_map<Key, typename Entries::iterator> index_;
+  uint64_t hits_ = 0;
+  uint64_t misses_ = 0;
+};
+
+} // namespace common
@@ -0,0 +1,124 @@
+#include "move_picker.h"
+
+#include <utility>
+
+namespace sovereign_chess {
+
+namespace {
+using PT = common::PieceType;
+
+int piece_value(PT type) {
+  switch (type) {
+  case PT::Pawn:
+    return 1;
+  case PT::Knight:
+  case PT::Bishop:
+    return 3;
+  case PT::Rook:
+    return 5;
+  case PT::Queen:
+    return 9;
+  case PT::King:
+    return 100;
+  default:
+    return 0;
+  }
+}
+} // namespace
+
+bool is_capture(const Board &board, const Move &move) {
+  return !move.is_defection() &&
+         board.packed_at(to_square(move.dest)) != kNoPiece;
+}
+
+MovePicker::MovePicker(const Board &board, std::optional<Move> hash_move,
+                       const Killers &killers)
+    : board_(board), moves_(make_move_list()) {
+  if (hash_move && is_possible_move(board, *hash_move))
+    hash_move_ = hash_move;
+  for (std::size_t i = 0; i < killers.size(); i++) {
+    const auto &killer = killers[i];
+    if (killer && !is_hash_move(*killer) && !is_capture(board, *killer) &&
+        is_possible_move(board, *killer))
+      killers_[i] = killer;
+  }
+}
+
+bool MovePicker::is_hash_move(const Move &move) const {
+  return hash_move_ && *hash_move_ == move;
+}
+
+bool MovePicker::is_killer(const Move &move) const {
+  for (const auto &killer : killers_) {
+    if (killer && *killer == move)
+      return true;
+  }
+  return false;
+}
+
+int MovePicker::capture_score(const Move &move) const {
+  return piece_value(type_of(board_.packed_at(to_square(move.dest)))) * 128 -
+         piece_value(type_of(board_.packed_at(to_square(move.src))));
+}
+
+std::optional<Move> MovePicker::next() {
+  while (true) {
+    switch (stage_) {
+    case Stage::HashMove:
+      stage_ = Stage::GenerateCaptures;
+      if (hash_move_)
+        return hash_move_;
+      break;
+    case Stage::GenerateCaptures:
+      get_possible_moves(board_, moves_, kCaptures);
+      stage_ = Stage::Captures;
+      break;
+    case Stage::Captures:
+      // Selection sort one move at a time, since a cutoff usually comes
+      // before the captures run out
+      while (index_ < moves_.size()) {
+        std::size_t best = index_;
+        int best_score = capture_score(moves_[best]);
+        for (std::size_t i = index_ + 1; i < moves_.size(); i++) {
+          const int score = capture_score(moves_[i]);
+          if (score > best_score) {
+            best = i;
+            best_score = score;
+          }
+        }
+        std::swap(moves_[index_], moves_[best]);
+        const Move &move = moves_[index_++];
+        if (!is_hash_move(move))
+          return move;
+      }
+      stage_ = Stage::Killers;
+      index_ = 0;
+      break;
+    case Stage::Killers:
+      while (index_ < killers_.size()) {
+        if (const auto &killer = killers_[index_++])
+          return killer;
+      }
+      stage_ = Stage::GenerateQuiets;
+      break;
+    case Stage::GenerateQuiets:
+      moves_.clear();
+      get_possible_moves(board_, moves_, kQuiets);
+      stage_ = Stage::Quiets;
+      index_ = 0;
+      break;
+    case Stage::Quiets:
+      while (index_ < moves_.size()) {
+        const Move &move = moves_[index_++];
+        if (!is_hash_move(move) && !is_killer(move))
+          return move;
+      }
+      stage_ = Stage::Done;
+      break;
+    case Stage::Done:
+      return {};
+    }
+  }
+}
+
+} // namespace sovereign_chess
@@ -0,0 +1,59 @@
+// Staged move ordering for alpha-beta search
+#pragma once
+#include <array>
+#include <cstddef>
+#include <optional>
+
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+// Whether the move lands on a piece
+bool is_capture(const Board &board, const Move &move);
+
+/** Hands out the possible moves of a position one at a time, best first: the
+ * hash move, captures of the most valuable victim by the least valuable
+ * attacker, killer moves, then quiet moves in generation order. Each stage is
+ * generated only when the one before runs out, so a cutoff on an early move
+ * skips generating the rest. Moves are possible but not necessarily legal;
+ * check is_legal_move before playing one.
+ *
+ * Moves are kept in the calling thread's arena, so create the picker inside
+ * a common::ArenaScope and don't open another one that outlives it.
+ */
+class MovePicker {
+public:
+  // Quiet moves that caused cutoffs at the same ply elsewhere in the search
+  using Killers = std::array<std::optional<Move>, 2>;
+
+  MovePicker(const Board &board, std::optional<Move> hash_move,
+             const Killers &killers = {});
+
+  // Empty once every possible move has been returned
+  std::optional<Move> next();
+
+private:
+  enum class Stage {
+    HashMove,
+    GenerateCaptures,
+    Captures,
+    Killers,
+    GenerateQuiets,
+    Quiets,
+    Done
+  };
+
+  // Returned by an earlier stage than its generated one
+  bool is_hash_move(const Move &move) const;
+  bool is_killer(const Move &move) const;
+  int capture_score(const Move &move) const;
+
+  const Board &board_;
+  std::optional<Move> hash_move_; // empty if not possible here
+  Killers killers_;               // only possible quiet moves
+  Stage stage_ = Stage::HashMove;
+  MoveList moves_;
+  std::size_t index_ = 0;
+};
+
+} // namespace sovereign_chess
@@ -0,0 +1,238 @@
+// Differential fuzzing of the move generator against the plain reference
+// implementation in reference_movegen.cpp.
+//
+// Usage: movegen_fuzz [--games N] [--plies N] [--seed N] [--threads N]
+// Plays random games from the initial position and from random placements,
+// comparing possible moves, legal moves, check, color control and the result
+// of every legal move at each position. Stops at the first difference and
+// prints the position's FEN and what differs.
+//
+// Built with -fsanitize=fuzzer and -DSOVEREIGN_LIBFUZZER instead (make
+// movegen_libfuzzer), it is a libFuzzer target that reads each input as a
+// binary position record.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "binary_position.h"
+#include "reference_movegen.h"
+#include "rng.h"
+#include "sovereign_chess.h"
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+std::vector<PackedMove> sorted(const std::vector<Move> &moves) {
+  std::vector<PackedMove> packed;
+  for (const Move &move : moves)
+    packed.push_back(pack_move(move));
+  std::sort(packed.begin(), packed.end());
+  return packed;
+}
+
+// Moves in a but not b
+std::string difference(const std::vector<PackedMove> &a,
+                       const std::vector<PackedMove> &b) {
+  std::vector<PackedMove> only;
+  std::set_difference(a.begin(), a.end(), b.begin(), b.end(),
+                      std::back_inserter(only));
+  std::ostringstream out;
+  for (PackedMove move : only)
+    out << " " << unpack_move(move).to_string();
+  return out.str();
+}
+
+// Empty if the generators agree on board, otherwise what differs
+std::optional<std::string> compare(const Board &board) {
+  const auto position = reference::Position::from_board(board);
+  std::ostringstream out;
+  for (int c = 1; c < 13; c++) {
+    const Color color = static_cast<Color>(c);
+    if (board.controlling_player(color) !=
+        reference::controlling_player(position, color))
+      out << "controlling_player differs for " << color_names.at(color)
+          << "\n";
+  }
+  const auto compare_moves = [&](const char *name, const auto &moves,
+                                 const auto &reference_moves) {
+    const auto a = sorted(moves), b = sorted(reference_moves);
+    if (a != b)
+      out << name << " differ. Extra:" << difference(a, b)
+          << " Missing:" << difference(b, a) << "\n";
+  };
+  const auto legal_moves = Game::get_legal_moves(board);
+  compare_moves("Possible moves", get_possible_moves(board),
+                reference::possible_moves(position));
+  compare_moves("Legal moves", legal_moves, reference::legal_moves(position));
+  if (is_in_check(board) != reference::is_in_check(position))
+    out << "is_in_check differs\n";
+  // Each make_move against the reference's own
+  for (const Move &move : legal_moves) {
+    Board next = board;
+    next.make_move(move);
+    reference::Position reference_next = position;
+    reference_next.make_move(move);
+    if (!(reference::Position::from_board(next) == reference_next))
+      out << "make_move differs for " << move.to_string() << "\n";
+  }
+  if (out.str().empty())
+    return {};
+  return out.str();
+}
+
+// Whether the other square of coord's color is occupied. Only one of each
+// pair may be, which both generators rely on.
+bool twin_square_occupied(const Board &board, const Coord &coord) {
+  const std::optional<Color> color = square_color(coord);
+  if (!color)
+    return false;
+  for (const auto &[other, other_color] : colored_squares) {
+    if (other_color == *color && !(other == coord) &&
+        board.piece_at(other).color != Color::Empty)
+      return true;
+  }
+  return false;
+}
+
+/** A random position: both kings of the owned colors, then pieces of random
+ * types and colors on random squares. Positions needn't be reachable, which
+ * exercises color control chains that games rarely reach.
+ */
+Board random_position(common::Rng &rng) {
+  Board board;
+  const Color owned[2] = {static_cast<Color>(1 + rng.below(12)),
+                          static_cast<Color>(1 + rng.below(11))};
+  board.owned_color(Player::Player1) = owned[0];
+  board.owned_color(Player::Player2) =
+      owned[1] >= owned[0] ? static_cast<Color>(static_cast<int>(owned[1]) + 1)
+                           : owned[1];
+  for (Player player : {Player::Player1, Player::Player2}) {
+    Coord coord = to_coord(rng.below(256));
+    while (board.piece_at(coord).color != Color::Empty ||
+           twin_square_occupied(board, coord))
+      coord = to_coord(rng.below(256));
+    board.place_piece({common::PieceType::King, board.owned_color(player)},
+                      coord);
+  }
+  const int pieces = 2 + rng.below(40);
+  for (int i = 0; i < pieces; i++) {
+    const Coord coord = to_coord(rng.below(256));
+    if (board.piece_at(coord).color != Color::Empty ||
+        twin_square_occupied(board, coord))
+      continue;
+    const auto type = static_cast<common::PieceType>(1 + rng.below(5));
+    board.place_piece({type, static_cast<Color>(1 + rng.below(12))}, coord);
+  }
+  for (Player player : {Player::Player1, Player::Player2}) {
+    for (Castle side : {Castle::Kingside, Castle::Queenside})
+      board.castle_right(player, side) = rng.below(2);
+  }
+  if (rng.below(2))
+    board.player_to_move() = Player::Player2;
+  return board;
+}
+
+struct Options {
+  int games = 1000;
+  int plies = 200;
+  uint64_t seed = 1;
+  unsigned threads = common::ThreadPool::default_workers() + 1;
+};
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return {};
+    }
+    std::string value = argv[++i];
+    if (arg == "--games")
+      options.games = std::stoi(value);
+    else if (arg == "--plies")
+      options.plies = std::stoi(value);
+    else if (arg == "--seed")
+      options.seed = std::stoull(value);
+    else if (arg == "--threads")
+      options.threads = std::stoi(value);
+    else {
+      std::cerr << "Unknown option " << arg << "\n";
+      return {};
+    }
+  }
+  return options;
+}
+
+} // namespace sovereign_chess
+
+#ifdef SOVEREIGN_LIBFUZZER
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, std::size_t size) {
+  using namespace sovereign_chess;
+  // decode_position rejects colors and types that no position has, but not
+  // placements
+  Board board;
+  if (!decode_position(data, size, board))
+    return 0;
+  for (int square = 0; square < 256; square++) {
+    const Coord coord = to_coord(square);
+    if (board.piece_at(coord).color != Color::Empty &&
+        twin_square_occupied(board, coord))
+      return 0;
+  }
+  if (auto difference = compare(board)) {
+    std::cerr << board.to_fen() << "\n" << *difference;
+    __builtin_trap();
+  }
+  return 0;
+}
+#else
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  common::ThreadPool pool(std::max(options->threads, 1u) - 1);
+  std::atomic<uint64_t> positions = 0;
+  std::atomic<bool> failed = false;
+  std::mutex output_mutex;
+  const auto start = std::chrono::steady_clock::now();
+  pool.parallel_for(options->games, [&](std::size_t game) {
+    common::Rng rng(options->seed + game);
+    // Alternate games from the start with random placements
+    Board board =
+        game % 2 ? random_position(rng) : Board::from_fen(kInitialFen);
+    for (int ply = 0; ply < options->plies && !failed; ply++) {
+      positions++;
+      if (auto difference = compare(board)) {
+        std::lock_guard lock(output_mutex);
+        if (!failed.exchange(true))
+          std::cout << "Difference in game " << game << " at ply " << ply
+                    << ":\n"
+                    << board.to_fen() << "\n"
+                    << *difference;
+        return;
+      }
+      const auto legal_moves = Game::get_legal_moves(board);
+      if (legal_moves.empty())
+        break;
+      board.make_move(legal_moves[rng.below(legal_moves.size())]);
+    }
+  });
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  std::cout << positions << " positions in " << elapsed.count() << "s, "
+            << positions / elapsed.count() << " positions/s\n";
+  if (failed)
+    return 1;
+  std::cout << "No differences\n";
+  return 0;
+}
+#endif
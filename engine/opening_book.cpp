@@ -0,0 +1,90 @@
+#include "opening_book.h"
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+
+namespace sovereign_chess {
+
+namespace {
+void write_le(uint8_t *out, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++)
+    out[i] = static_cast<uint8_t>(value >> (8 * i));
+}
+uint64_t read_le(const uint8_t *in, int bytes) {
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; i++)
+    value |= uint64_t{in[i]} << (8 * i);
+  return value;
+}
+} // namespace
+
+void write_book(std::ostream &out, std::vector<BookEntry> entries) {
+  std::stable_sort(entries.begin(), entries.end(),
+                   [](const BookEntry &a, const BookEntry &b) {
+                     return a.hash < b.hash;
+                   });
+  auto last = std::unique(entries.begin(), entries.end(),
+                          [](const BookEntry &a, const BookEntry &b) {
+                            return a.hash == b.hash;
+                          });
+  entries.erase(last, entries.end());
+
+  char header[kBookFileHeaderSize] = {};
+  std::memcpy(header, kBookFileMagic, sizeof(kBookFileMagic) - 1);
+  header[5] = kBookFileVersion;
+  out.write(header, sizeof(header));
+
+  for (const BookEntry &entry : entries) {
+    uint8_t record[kBookEntrySize];
+    write_le(record, entry.hash, 8);
+    write_le(record + 8, entry.move, 4);
+    write_le(record + 12, static_cast<uint32_t>(entry.score), 4);
+    out.write(reinterpret_cast<const char *>(record), sizeof(record));
+  }
+}
+
+OpeningBook::OpeningBook(const uint8_t *data, std::size_t size) {
+  if (data == nullptr || size < kBookFileHeaderSize ||
+      std::memcmp(data, kBookFileMagic, sizeof(kBookFileMagic) - 1) != 0 ||
+      data[5] != kBookFileVersion)
+    return;
+  entries_ = data + kBookFileHeaderSize;
+  count_ = (size - kBookFileHeaderSize) / kBookEntrySize;
+}
+
+BookEntry OpeningBook::entry(std::size_t index) const {
+  const uint8_t *record = entries_ + index * kBookEntrySize;
+  return BookEntry{read_le(record, 8),
+                   static_cast<PackedMove>(read_le(record + 8, 4)),
+                   static_cast<int32_t>(read_le(record + 12, 4))};
+}
+
+std::optional<BookEntry> OpeningBook::find(const Board &board) const {
+  const uint64_t hash = board.hash();
+  std::size_t low = 0, high = count_;
+  while (low < high) {
+    std::size_t mid = low + (high - low) / 2;
+    uint64_t mid_hash = read_le(entries_ + mid * kBookEntrySize, 8);
+    if (mid_hash < hash)
+      low = mid + 1;
+    else
+      high = mid;
+  }
+  if (low == count_ || read_le(entries_ + low * kBookEntrySize, 8) != hash)
+    return {};
+  return entry(low);
+}
+
+std::optional<Move> OpeningBook::lookup(const Board &board) const {
+  auto found = find(board);
+  if (!found)
+    return {};
+  // Guard against hash collisions with positions outside the book
+  Move move = unpack_move(found->move);
+  if (!is_possible_move(board, move) || !is_legal_move(board, move))
+    return {};
+  return move;
+}
+
+} // namespace sovereign_chess
@@ -0,0 +1,56 @@
+// Precomputed moves for positions near the start of the game
+#pragma once
+#include <cstdint>
+#include <iosfwd>
+#include <optional>
+#include <vector>
+
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+struct BookEntry {
+  uint64_t hash = 0; // Board::hash of the position
+  PackedMove move = 0;
+  int32_t score = 0; // Share of search visits on the move, per mille
+};
+
+/** Book files are an 8 byte header followed by 16-byte entries sorted by
+ * hash, one per position, multi-byte fields little endian:
+ * - bytes 0-7: position hash
+ * - bytes 8-11: packed move
+ * - bytes 12-15: score
+ */
+constexpr char kBookFileMagic[6] = "SCBOK";
+constexpr uint8_t kBookFileVersion = 1;
+constexpr std::size_t kBookFileHeaderSize = 8;
+constexpr std::size_t kBookEntrySize = 16;
+
+// Sort entries by hash and write them as a book file. Later entries for a
+// position already written are dropped.
+void write_book(std::ostream &out, std::vector<BookEntry> entries);
+
+// Lookups over a book file held in memory, e.g. a MappedFile or a file
+// embedded in the wasm module. The data must outlive the book.
+class OpeningBook {
+public:
+  OpeningBook() = default;
+  OpeningBook(const uint8_t *data, std::size_t size);
+
+  // False if the header is missing or has the wrong version
+  bool valid() const { return entries_ != nullptr; }
+  std::size_t size() const { return count_; }
+
+  // Binary search for the position
+  std::optional<BookEntry> find(const Board &board) const;
+  // The book move if the position is found and the move is legal in it
+  std::optional<Move> lookup(const Board &board) const;
+
+private:
+  BookEntry entry(std::size_t index) const;
+
+  const uint8_t *entries_ = nullptr;
+  std::size_t count_ = 0;
+};
+
+} // namespace sovereign_chess
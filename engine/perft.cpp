@@ -0,0 +1,89 @@
+// Counts leaf nodes of the sovereign chess game tree and reports speed.
+//
+// Usage: perft DEPTH [FEN] [--divide] [--chess]
+// With --chess, the same driver runs on the standard chess engine, whose node
+// counts are widely published. Built with PROFILE=1, it also reports time
+// spent in the engine's timed scopes.
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "alloc_counter.h"
+#include "perft.h"
+#include "profile.h"
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+const std::string kChessInitialFen =
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+template <typename Move> std::string move_name(const Move &move) {
+  if constexpr (requires { move.to_string(); }) {
+    return move.to_string();
+  } else {
+    std::ostringstream out;
+    out << move;
+    return out.str();
+  }
+}
+
+template <common::Game G>
+uint64_t run_perft(const typename G::Board &board, int depth, bool divide) {
+  if (!divide || depth == 0)
+    return common::perft<G>(board, depth);
+
+  common::ArenaScope scope;
+  typename G::MoveList legal_moves = common::make_move_list<G>();
+  G::get_legal_moves(board, legal_moves);
+  uint64_t nodes = 0;
+  for (const auto &move : legal_moves) {
+    typename G::Board new_board = board;
+    new_board.make_move(move);
+    uint64_t subnodes = common::perft<G>(new_board, depth - 1);
+    std::cout << move_name(move) << " " << subnodes << "\n";
+    nodes += subnodes;
+  }
+  return nodes;
+}
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  if (argc < 2) {
+    std::cerr << "Usage: perft DEPTH [FEN] [--divide] [--chess]\n";
+    return 1;
+  }
+  int depth = std::stoi(argv[1]);
+  std::string fen;
+  bool divide = false, chess = false;
+  for (int i = 2; i < argc; i++) {
+    if (std::string(argv[i]) == "--divide")
+      divide = true;
+    else if (std::string(argv[i]) == "--chess")
+      chess = true;
+    else
+      fen = argv[i];
+  }
+  if (fen.empty())
+    fen = chess ? kChessInitialFen : kInitialFen;
+
+  const uint64_t allocations_before = common::allocation_count();
+  const auto start = std::chrono::steady_clock::now();
+  const uint64_t nodes =
+      chess ? run_perft<chess::Game>(chess::Board::from_fen(fen), depth, divide)
+            : run_perft<Game>(Board::from_fen(fen), depth, divide);
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const uint64_t allocations =
+      common::allocation_count() - allocations_before;
+
+  std::cout << "Nodes: " << nodes << "\n";
+  std::cout << "Time: " << elapsed.count() << "s, "
+            << nodes / elapsed.count() << " nodes/s\n";
+  std::cout << "Allocations: " << allocations << ", "
+            << static_cast<double>(allocations) / std::max<uint64_t>(nodes, 1)
+            << " per node" << std::endl;
+  common::Profiler::instance().report(std::cout);
+  return 0;
+}
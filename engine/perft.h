@@ -0,0 +1,14 @@
+// Move generation correctness and speed testing by counting game tree leaves
+#pragma once
+#include <cstdint>
+
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+// Number of positions reachable from board in exactly depth plies
+inline uint64_t perft(const Board &board, int depth) {
+  return common::perft<Game>(board, depth);
+}
+
+} // namespace sovereign_chess
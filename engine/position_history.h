@@ -0,0 +1,52 @@
+// Stack of position hashes along a game or search line, for repetition
+// detection
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "sovereign_chess.h"
+
+namespace sovereign_chess {
+
+class PositionHistory {
+public:
+  void push(const Board &board) {
+    entries_.push_back({board.hash(), board.halfmove_clock()});
+  }
+  void pop() { entries_.pop_back(); }
+  // Pop back to an earlier size
+  void truncate(std::size_t size) { entries_.resize(size); }
+  void clear() { entries_.clear(); }
+  std::size_t size() const { return entries_.size(); }
+  bool empty() const { return entries_.empty(); }
+
+  // Earlier occurrences of the latest position. A capture or pawn move can't
+  // be undone, so only the plies since the last one (counted by the halfmove
+  // clock) are scanned, and only those with the same player to move.
+  int repetitions() const {
+    if (entries_.size() < 3)
+      return 0;
+    const Entry &latest = entries_.back();
+    const std::size_t reversible =
+        std::min<std::size_t>(latest.halfmove_clock, entries_.size() - 1);
+    int count = 0;
+    for (std::size_t back = 2; back <= reversible; back += 2) {
+      if (entries_[entries_.size() - 1 - back].hash == latest.hash)
+        count++;
+    }
+    return count;
+  }
+
+  // Third occurrence of the same position
+  bool is_threefold() const { return repetitions() >= 2; }
+
+private:
+  struct Entry {
+    uint64_t hash;
+    int halfmove_clock;
+  };
+  std::vector<Entry> entries_;
+};
+
+} // namespace sovereign_chess
@@ -0,0 +1,165 @@
+// Scoped timers for finding where search time goes. PROFILE_SCOPE compiles to
+// nothing unless SOVEREIGN_PROFILE is defined (make PROFILE=1).
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace common {
+
+// The time stamp counter where there is one, which is much cheaper to read
+// than steady_clock; otherwise steady_clock nanoseconds
+inline uint64_t profile_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/** Named timers, each counting calls and total ticks. Scopes add to their
+ * own thread's accumulators, so a timed scope costs two counter reads and no
+ * synchronization; threads' totals are summed when reported, and merged
+ * into the profiler when a thread exits. Ticks are converted to time by
+ * comparing them to steady_clock since the profiler started. Times are
+ * inclusive, so a timed scope called from another counts toward both.
+ */
+class Profiler {
+public:
+  static constexpr std::size_t kMaxTimers = 32;
+  struct Totals {
+    uint64_t calls = 0;
+    uint64_t ticks = 0;
+  };
+  using ThreadTotals = std::array<Totals, kMaxTimers>;
+
+  static Profiler &instance() {
+    static Profiler profiler;
+    return profiler;
+  }
+
+  // Index of the named timer, registered on first use
+  std::size_t timer(const char *name) {
+    std::lock_guard lock(mutex_);
+    for (std::size_t i = 0; i < names_.size(); i++) {
+      if (names_[i] == name)
+        return i;
+    }
+    names_.push_back(name);
+    return names_.size() - 1;
+  }
+
+  // The calling thread's accumulators
+  static ThreadTotals &thread_totals() {
+    thread_local Registration registration;
+    return registration.totals;
+  }
+
+  // Totals of every timer across threads. Read while no timed code runs.
+  std::vector<std::pair<std::string, Totals>> totals() {
+    std::lock_guard lock(mutex_);
+    std::vector<std::pair<std::string, Totals>> result;
+    for (std::size_t i = 0; i < names_.size(); i++) {
+      Totals sum = exited_[i];
+      for (const ThreadTotals *thread : live_) {
+        sum.calls += (*thread)[i].calls;
+        sum.ticks += (*thread)[i].ticks;
+      }
+      result.emplace_back(names_[i], sum);
+    }
+    return result;
+  }
+
+  double seconds_per_tick() const {
+    const std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time_;
+    return elapsed.count() / std::max<uint64_t>(profile_ticks() - start_, 1);
+  }
+
+  // One line per timer, or nothing if profiling is compiled out
+  void report(std::ostream &out) {
+    const double tick = seconds_per_tick();
+    for (const auto &[name, totals] : totals()) {
+      out << "Profile: " << std::left << std::setw(20) << name << std::right
+          << std::setw(12) << totals.calls << " calls " << std::setw(10)
+          << std::fixed << std::setprecision(3) << totals.ticks * tick
+          << "s " << std::setw(8) << std::setprecision(1)
+          << totals.ticks * tick * 1e9 / std::max<uint64_t>(totals.calls, 1)
+          << " ns/call\n";
+      out << std::defaultfloat;
+    }
+  }
+
+private:
+  // Lists a thread's accumulators while it lives
+  struct Registration {
+    ThreadTotals totals{};
+    Registration() {
+      Profiler &profiler = instance();
+      std::lock_guard lock(profiler.mutex_);
+      profiler.live_.push_back(&totals);
+    }
+    ~Registration() {
+      Profiler &profiler = instance();
+      std::lock_guard lock(profiler.mutex_);
+      for (std::size_t i = 0; i < kMaxTimers; i++) {
+        profiler.exited_[i].calls += totals[i].calls;
+        profiler.exited_[i].ticks += totals[i].ticks;
+      }
+      std::erase(profiler.live_, &totals);
+    }
+  };
+
+  std::chrono::steady_clock::time_point start_time_ =
+      std::chrono::steady_clock::now();
+  uint64_t start_ = profile_ticks();
+  std::mutex mutex_;
+  std::vector<std::string> names_;
+  std::vector<const ThreadTotals *> live_;
+  ThreadTotals exited_{};
+};
+
+class ProfileScope {
+public:
+  explicit ProfileScope(std::size_t timer)
+      : totals_(Profiler::thread_totals()[timer]), start_(profile_ticks()) {}
+  ~ProfileScope() {
+    totals_.calls++;
+    totals_.ticks += profile_ticks() - start_;
+  }
+
+  ProfileScope(const ProfileScope &) = delete;
+  ProfileScope &operator=(const ProfileScope &) = delete;
+
+private:
+  Profiler::Totals &totals_;
+  uint64_t start_;
+};
+
+} // namespace common
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+
+// Times the rest of the enclosing scope under name, a string literal
+#ifdef SOVEREIGN_PROFILE
+#define PROFILE_SCOPE(name)                                                    \
+  static const std::size_t PROFILE_CONCAT(profile_timer_, __LINE__) =          \
+      common::Profiler::instance().timer(name);                                \
+  common::ProfileScope PROFILE_CONCAT(profile_scope_, __LINE__)(               \
+      PROFILE_CONCAT(profile_timer_, __LINE__))
+#else
+#define PROFILE_SCOPE(name)
+#endif
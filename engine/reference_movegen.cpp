@@ -0,0 +1,395 @@
+#include "reference_movegen.h"
+
+#include <cmath>
+#include <unordered_map>
+
+namespace sovereign_chess::reference {
+
+namespace {
+using PT = common::PieceType;
+// ----------------------------- Move engine ---------------------------
+
+bool in_range(int coord) { return coord >= 0 && coord <= 15; }
+bool in_range(const Coord &coord) {
+  return in_range(coord.rank) && in_range(coord.file);
+}
+
+bool is_enemy_color(const Position &position, Color color) {
+  return controlling_player(position, color) ==
+         other_player(position.player_to_move);
+}
+
+// Precondition: square must be colored
+Coord other_square_of_same_color(const Coord &coord) {
+  // Compute map of coords by color
+  std::unordered_map<Color, std::vector<Coord>> coords_by_color;
+  for (const auto &[coord, color] : colored_squares) {
+    coords_by_color[color].push_back(coord);
+  }
+
+  // Compute map of square->square for all colors
+  std::unordered_map<Coord, Coord, common::coord_hash> other_square;
+  for (const auto &[color, coords] : coords_by_color) {
+    other_square[coords[0]] = coords[1];
+    other_square[coords[1]] = coords[0];
+  }
+
+  return other_square.at(coord);
+}
+
+// Return false if move violates coloring rules of target square.
+// Precondition: piece exists at source square
+bool check_target_square_color(const Position &position, const Coord &src,
+                               const Coord &dest) {
+  Color piece_color = position.piece_at(src).color;
+
+  std::optional<Color> dest_color = square_color(dest);
+
+  // No rules if target square is uncolored
+  if (!dest_color)
+    return true;
+
+  // may not land on square of same color
+  if (*dest_color == piece_color)
+    return false;
+
+  // If this is a capture, no further checking needed
+  if (position.piece_at(dest).color != Color::Empty)
+    return true;
+
+  // Cannot land on colored square if other square of same color has piece
+  if (position.piece_at(other_square_of_same_color(dest)).color !=
+      Color::Empty)
+    return false;
+
+  return true;
+}
+
+// Knight, king
+void fill_possible_nonrepeating_moves(const Position &position,
+                                      const std::vector<Coord> &relative_moves,
+                                      const Coord &src,
+                                      std::vector<Move> &moves) {
+  for (const Coord &relative : relative_moves) {
+    Coord target = src + relative;
+    if (in_range(target) &&
+        check_target_square_color(position, src, target) &&
+        (position.piece_at(target).color == Color::Empty ||
+         is_enemy_color(position, position.piece_at(target).color))) {
+      moves.push_back({src, target});
+    }
+  }
+}
+
+// Bishop, queen, rook
+void fill_possible_repeating_moves(const Position &position,
+                                   const std::vector<Coord> &relative_moves,
+                                   const Coord &src, std::vector<Move> &moves) {
+  for (const Coord &relative : relative_moves) {
+    Coord target = src;
+    while (true) {
+      target = target + relative;
+      // if we're off board, stop
+      if (!in_range(target)) {
+        break;
+      } else if (position.piece_at(target).color == Color::Empty) {
+        if (check_target_square_color(position, src, target)) {
+          // Empty square that we can move to, continue
+          moves.push_back({src, target});
+        }
+        // if it's empty but we fail color checks, keep going
+      } else if (is_enemy_color(position, position.piece_at(target).color) &&
+                 check_target_square_color(position, src, target)) {
+        // Enemy piece, and we're not landing on our own color, so record move
+        // but stop
+        moves.push_back({src, target});
+        break;
+      } else {
+        // Not empty and not capturable, stop
+        break;
+      }
+    }
+  }
+}
+
+void fill_possible_pawn_moves(const Position &position, const Coord &src,
+                              std::vector<Move> &moves) {
+  // Non-capture
+  for (const auto &step : common::kOrthogonalSteps) {
+    Coord dest = src + step;
+    // Check that we're getting closer to the center
+    if (std::abs(dest.rank - 7.5) < std::abs(src.rank - 7.5) ||
+        std::abs(dest.file - 7.5) < std::abs(src.file - 7.5)) {
+      if (position.piece_at(dest).color != Color::Empty)
+        continue; // can't capture
+
+      if (check_target_square_color(position, src, dest)) {
+        moves.push_back(Move{src, dest});
+      }
+
+      // If we weren't blocked, try two-step advance
+      Coord two_step = step + step;
+      if (!in_range(src - two_step) && // Check if we're on outer two rings
+          position.piece_at(src + two_step).color == Color::Empty &&
+          check_target_square_color(position, src, src + two_step)) {
+        moves.push_back(Move{src, src + two_step});
+      }
+    }
+  }
+
+  // Capture
+  for (const auto &step : common::kDiagonalSteps) {
+    Coord dest = src + step;
+    // An edge pawn's diagonal can leave the board while nearing a centerline
+    if (!in_range(dest))
+      continue;
+    const Piece &target_p = position.piece_at(dest);
+    // Check that we're getting closer to a centerline
+    if ((std::abs(dest.rank - 7.5) < std::abs(src.rank - 7.5) ||
+         std::abs(dest.file - 7.5) < std::abs(src.file - 7.5)) &&
+        controlling_player(position, target_p.color) ==
+            other_player(position.player_to_move) &&
+        check_target_square_color(position, src, dest)) {
+      moves.push_back(Move{src, dest});
+    }
+  }
+}
+
+// Castling and defection, for the king of the owned color
+void fill_possible_king_special_moves(const Position &position,
+                                      const Coord &src,
+                                      std::vector<Move> &moves) {
+  const Player player = position.player_to_move;
+  const Color owned = position.owned_color(player);
+  if (position.piece_at(src).color != owned)
+    return;
+
+  // The king moves two files toward a rook of any controlled color, if
+  // nothing stands between them
+  if (src == king_origin(player)) {
+    for (Castle side : {Castle::Kingside, Castle::Queenside}) {
+      const Coord rook = rook_origin(player, side);
+      const Piece &rook_p = position.piece_at(rook);
+      if (!position.castle_right(player, side) || rook_p.type != PT::Rook ||
+          controlling_player(position, rook_p.color) != player)
+        continue;
+      const int step = rook.file > src.file ? 1 : -1;
+      bool blocked = false;
+      for (int file = src.file + step; file != rook.file; file += step)
+        blocked |= position.piece_at({src.rank, file}).color != Color::Empty;
+      if (!blocked)
+        moves.push_back(Move{src, Coord{src.rank, src.file + 2 * step}});
+    }
+  }
+
+  // The king may defect to any other color the player controls
+  for (int c = 1; c < 13; c++) {
+    const Color color = static_cast<Color>(c);
+    if (color != owned && controlling_player(position, color) == player)
+      moves.push_back(Move::defection(src, color));
+  }
+}
+
+bool is_castle(const Position &position, const Move &move) {
+  return position.piece_at(move.src).type == PT::King &&
+         std::abs(move.dest.file - move.src.file) == 2;
+}
+
+bool move_kills_king(const Position &position, const Move &move) {
+  return !move.is_defection() && position.piece_at(move.dest).type == PT::King;
+}
+
+bool move_into_check(const Position &position, const Move &move) {
+  // A king may not castle out of or through check
+  if (is_castle(position, move)) {
+    Coord crossed{move.src.rank, (move.src.file + move.dest.file) / 2};
+    if (is_in_check(position) ||
+        move_into_check(position, Move{move.src, crossed}))
+      return true;
+  }
+
+  Position next_position = position;
+  next_position.make_move(move);
+  next_position.player_to_move = other_player(next_position.player_to_move);
+  return is_in_check(next_position);
+}
+
+std::optional<Player> controlling_player(const Position &position,
+                                         Color color, int links) {
+  // A chain longer than the number of colors is a cycle with no owned color
+  // in it, which defection can leave behind
+  if (color == Color::Empty || links > 12)
+    return {};
+  if (position.owned_color(Player::Player1) == color)
+    return Player::Player1;
+  if (position.owned_color(Player::Player2) == color)
+    return Player::Player2;
+  for (const auto &[coord, sq_color] : colored_squares) {
+    if (sq_color == color) {
+      const Piece &piece = position.piece_at(coord);
+      if (piece.color != Color::Empty) {
+        // Only one piece may occupy either colored square
+        return controlling_player(position, piece.color, links + 1);
+      }
+    }
+  }
+
+  // Neutral color
+  return {};
+}
+} // namespace
+
+Position Position::from_board(const Board &board) {
+  Position position;
+  for (int rank = 0; rank < 16; rank++) {
+    for (int file = 0; file < 16; file++)
+      position.pieces[rank][file] = board.piece_at({rank, file});
+  }
+  position.player_to_move = board.player_to_move();
+  for (Player player : {Player::Player1, Player::Player2}) {
+    position.owned_color(player) = board.owned_color(player);
+    for (Castle side : {Castle::Kingside, Castle::Queenside})
+      position.castle_right(player, side) = board.castle_right(player, side);
+  }
+  position.halfmove_clock = board.halfmove_clock();
+  position.fullmove_number = board.fullmove_number();
+  return position;
+}
+
+void Position::make_move(const Move &move) {
+  const Player player = player_to_move;
+  const Player opponent = other_player(player);
+
+  // Defection gives the king the new color, which the player now owns
+  if (move.is_defection()) {
+    piece_at(move.src).color = move.defect_color;
+    owned_color(player) = move.defect_color;
+    halfmove_clock++;
+  } else {
+    // Castle rights are lost when the king moves, or when anything moves
+    // from or onto a rook origin square
+    if (move.src == king_origin(player)) {
+      castle_right(player, Castle::Kingside) = false;
+      castle_right(player, Castle::Queenside) = false;
+    }
+    for (Player p : {player, opponent}) {
+      for (Castle side : {Castle::Kingside, Castle::Queenside}) {
+        if (move.src == rook_origin(p, side) ||
+            move.dest == rook_origin(p, side))
+          castle_right(p, side) = false;
+      }
+    }
+
+    // Halfmove clock resets on captures and pawn moves
+    if (piece_at(move.src).type == PT::Pawn ||
+        piece_at(move.dest).color != Color::Empty)
+      halfmove_clock = 0;
+    else
+      halfmove_clock++;
+
+    // Castling also moves the rook onto the square the king crossed
+    if (is_castle(*this, move)) {
+      Castle side =
+          move.dest.file > move.src.file ? Castle::Kingside : Castle::Queenside;
+      Coord rook = rook_origin(player, side);
+      Coord crossed{move.src.rank, (move.src.file + move.dest.file) / 2};
+      piece_at(crossed) = piece_at(rook);
+      piece_at(rook) = Piece{};
+    }
+
+    // Basic move
+    piece_at(move.dest) = piece_at(move.src);
+    piece_at(move.src) = Piece{};
+
+    // Promotion
+    if (move.promotion_type != PieceType::Invalid) {
+      piece_at(move.dest).type = move.promotion_type;
+    }
+  }
+
+  // swap player
+  if (player == Player::Player2)
+    fullmove_number++;
+  player_to_move = opponent;
+}
+
+std::optional<Player> controlling_player(const Position &position,
+                                         Color color) {
+  return controlling_player(position, color, 0);
+}
+
+std::vector<Move> possible_moves(const Position &position) {
+
+  std::vector<Move> moves;
+  // Iterate over all pieces of the colors the player controls
+  for (int rank = 0; rank < 16; rank++) {
+    for (int file = 0; file < 16; file++) {
+      Coord coord{rank, file};
+      const Piece &piece = position.piece_at(coord);
+      if (piece.color != Color::Empty &&
+          controlling_player(position, piece.color) ==
+              position.player_to_move) {
+        // Pawns
+        if (piece.type == PieceType::Pawn) {
+          fill_possible_pawn_moves(position, coord, moves);
+        }
+
+        // Kings
+        else if (piece.type == PieceType::King) {
+          fill_possible_nonrepeating_moves(position, common::kDiagonalSteps,
+                                           coord, moves);
+          fill_possible_nonrepeating_moves(position, common::kOrthogonalSteps,
+                                           coord, moves);
+          fill_possible_king_special_moves(position, coord, moves);
+        }
+
+        // Knights
+        else if (piece.type == PieceType::Knight) {
+          fill_possible_nonrepeating_moves(position, common::kKnightSteps,
+                                           coord, moves);
+        }
+
+        // Bishops
+        else if (piece.type == PieceType::Bishop) {
+          fill_possible_repeating_moves(position, common::kDiagonalSteps,
+                                        coord, moves);
+        }
+
+        // Rook
+        else if (piece.type == PieceType::Rook) {
+          fill_possible_repeating_moves(position, common::kOrthogonalSteps,
+                                        coord, moves);
+        }
+
+        // Queen
+        else if (piece.type == PieceType::Queen) {
+          fill_possible_repeating_moves(position, common::kOrthogonalSteps,
+                                        coord, moves);
+          fill_possible_repeating_moves(position, common::kDiagonalSteps,
+                                        coord, moves);
+        }
+      }
+    }
+  }
+  return moves;
+}
+
+bool is_in_check(const Position &position) {
+  Position next_position = position;
+  next_position.player_to_move = other_player(next_position.player_to_move);
+  auto responses = possible_moves(next_position);
+  for (const Move &response : responses) {
+    if (move_kills_king(next_position, response))
+      return true;
+  }
+  return false;
+}
+
+std::vector<Move> legal_moves(const Position &position) {
+  std::vector<Move> moves = possible_moves(position);
+  std::erase_if(moves,
+                [&](const Move &m) { return move_into_check(position, m); });
+  return moves;
+}
+
+} // namespace sovereign_chess::reference
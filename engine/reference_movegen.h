@@ -0,0 +1,63 @@
+// The original straightforward move generator, kept to check the optimized
+// one against.
+//
+// Ported from the first version of sovereign_chess.cpp: pieces in a 16x16
+// array of coordinates, colored squares looked up in colored_squares, and
+// its own make_move, so it shares no code with the packed board, move tables,
+// piece sets or SIMD color scans. Rules added since (castling, defection,
+// castle rights and counters, control cycles left by defection, and pawns on
+// the edge) are written in the same plain style. movegen_fuzz.cpp compares
+// the two. Keep it simple rather than fast.
+#pragma once
+#include <array>
+#include <optional>
+#include <vector>
+
+#include "sovereign_chess.h"
+
+namespace sovereign_chess::reference {
+
+struct Position {
+  std::array<std::array<Piece, 16>, 16> pieces{}; // by rank, then file
+  Player player_to_move = Player::Player1;
+  std::array<Color, 2> owned_colors = {Color::White, Color::Black};
+  std::array<std::array<bool, 2>, 2> castle_rights{}; // by player, then side
+  int halfmove_clock = 0;
+  int fullmove_number = 1;
+
+  static Position from_board(const Board &board);
+
+  const Piece &piece_at(const Coord &coord) const {
+    return pieces[coord.rank][coord.file];
+  }
+  Piece &piece_at(const Coord &coord) {
+    return pieces[coord.rank][coord.file];
+  }
+  Color &owned_color(Player player) {
+    return owned_colors[static_cast<int>(player)];
+  }
+  Color owned_color(Player player) const {
+    return owned_colors[static_cast<int>(player)];
+  }
+  bool &castle_right(Player player, Castle side) {
+    return castle_rights[static_cast<int>(player)][static_cast<int>(side)];
+  }
+  bool castle_right(Player player, Castle side) const {
+    return castle_rights[static_cast<int>(player)][static_cast<int>(side)];
+  }
+
+  // Move is assumed to be possible
+  void make_move(const Move &move);
+
+  bool operator==(const Position &other) const = default;
+};
+
+// Follows the chain of pieces on colored squares to an owned color
+std::optional<Player> controlling_player(const Position &position,
+                                         Color color);
+
+std::vector<Move> possible_moves(const Position &position);
+bool is_in_check(const Position &position);
+std::vector<Move> legal_moves(const Position &position);
+
+} // namespace sovereign_chess::reference
@@ -0,0 +1,57 @@
+// Small, fast, seedable random number generator. Each instance owns its
+// state, so threads never contend and a seed fully determines the sequence.
+#pragma once
+#include <cstdint>
+#include <limits>
+
+namespace common {
+
+// Used to expand a single seed into generator state
+inline uint64_t splitmix64(uint64_t &state) {
+  uint64_t z = (state += 0x9e3779b97f4a7c15);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+
+// xoshiro256** (Blackman and Vigna). Satisfies UniformRandomBitGenerator.
+class Rng {
+public:
+  using result_type = uint64_t;
+
+  explicit Rng(uint64_t seed = 0) { reseed(seed); }
+
+  void reseed(uint64_t seed) {
+    for (auto &word : state_)
+      word = splitmix64(seed);
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() {
+    return std::numeric_limits<result_type>::max();
+  }
+
+  result_type operator()() {
+    const uint64_t result = rotl(state_[1] * 5, 7) * 9;
+    const uint64_t t = state_[1] << 17;
+    state_[2] ^= state_[0];
+    state_[3] ^= state_[1];
+    state_[1] ^= state_[2];
+    state_[0] ^= state_[3];
+    state_[2] ^= t;
+    state_[3] = rotl(state_[3], 45);
+    return result;
+  }
+
+  // Uniform integer in [0, bound), via Lemire's multiply-shift
+  uint32_t below(uint32_t bound) {
+    return static_cast<uint32_t>(((*this)() >> 32) * bound >> 32);
+  }
+
+private:
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+  uint64_t state_[4];
+};
+
+} // namespace common
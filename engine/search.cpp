@@ -0,0 +1,369 @@
+#include "search.h"
+
+#include <algorithm>
+
+#include "profile.h"
+
+namespace sovereign_chess {
+
+namespace {
+constexpr int kInfinity = kMateScore + 1;
+using Bound = TranspositionTable::Bound;
+
+/** Slot data: bits 0-23 the PackedMove (0 for none), 24-39 the score
+ * offset by 2^15, 40-47 the depth and 48-49 the bound.
+ */
+uint64_t pack_entry(const TranspositionTable::Entry &entry) {
+  return uint64_t{entry.move ? pack_move(*entry.move) : 0} |
+         uint64_t{static_cast<uint16_t>(entry.score + 32768)} << 24 |
+         uint64_t{static_cast<uint8_t>(entry.depth)} << 40 |
+         uint64_t{static_cast<uint8_t>(entry.bound)} << 48;
+}
+
+TranspositionTable::Entry unpack_entry(uint64_t data) {
+  TranspositionTable::Entry entry;
+  if (const PackedMove move = data & 0xffffff)
+    entry.move = unpack_move(move);
+  entry.score = static_cast<int>(data >> 24 & 0xffff) - 32768;
+  entry.depth = data >> 40 & 0xff;
+  entry.bound = static_cast<Bound>(data >> 48 & 3);
+  return entry;
+}
+
+// The table counts mates from the stored position rather than the root, so
+// that they stay right when the position is reached at another ply
+int score_to_table(int score, int ply) {
+  if (score > kMateScore - kMaxPly)
+    return score + ply;
+  if (score < -kMateScore + kMaxPly)
+    return score - ply;
+  return score;
+}
+int score_from_table(int score, int ply) {
+  if (score > kMateScore - kMaxPly)
+    return score - ply;
+  if (score < -kMateScore + kMaxPly)
+    return score + ply;
+  return score;
+}
+} // namespace
+
+TranspositionTable::TranspositionTable(std::size_t megabytes) {
+  const std::size_t bytes = std::max<std::size_t>(megabytes, 1) << 20;
+  std::size_t slots = 1;
+  while (slots * 2 * sizeof(Slot) <= bytes)
+    slots *= 2;
+  slots_ = std::make_unique<Slot[]>(slots);
+  mask_ = slots - 1;
+  clear();
+}
+
+std::optional<TranspositionTable::Entry>
+TranspositionTable::probe(uint64_t hash) const {
+  const Slot &slot = slots_[hash & mask_];
+  const uint64_t data = slot.data.load(std::memory_order_relaxed);
+  if ((slot.check.load(std::memory_order_relaxed) ^ data) != hash)
+    return {};
+  Entry entry = unpack_entry(data);
+  if (entry.bound == Bound::None)
+    return {};
+  return entry;
+}
+
+void TranspositionTable::store(uint64_t hash, const Entry &entry) {
+  Slot &slot = slots_[hash & mask_];
+  const uint64_t data = pack_entry(entry);
+  slot.check.store(hash ^ data, std::memory_order_relaxed);
+  slot.data.store(data, std::memory_order_relaxed);
+}
+
+void TranspositionTable::clear() {
+  for (std::size_t i = 0; i <= mask_; i++) {
+    slots_[i].check.store(0, std::memory_order_relaxed);
+    slots_[i].data.store(0, std::memory_order_relaxed);
+  }
+}
+
+SearchResult Searcher::search(const Board &board,
+                              const PositionHistory &history,
+                              const SearchLimits &limits,
+                              const Progress &progress) {
+  limits_ = limits;
+  limits_.depth = std::clamp(limits.depth, 1, kMaxPly - 1);
+  start_ = std::chrono::steady_clock::now();
+  nodes_ = 0;
+  aborted_ = false;
+  history_ = history;
+  if (history_.empty())
+    history_.push(board);
+  std::fill(killers_.begin(), killers_.end(), MovePicker::Killers{});
+
+  SearchResult result;
+  for (int depth = 1; depth <= limits_.depth; depth++) {
+    root_best_.reset();
+    const int score = negamax(board, depth, 0, -kInfinity, kInfinity);
+    if (aborted_) {
+      // A partial iteration searches the previous best move first, so any
+      // better move it found is still an improvement
+      if (root_best_)
+        result.best_move = root_best_;
+      break;
+    }
+    result.best_move = root_best_;
+    result.score = score;
+    result.depth = depth;
+    result.pv = principal_variation(board, depth);
+    result.nodes = nodes_;
+    result.seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_)
+                         .count();
+    if (progress)
+      progress(result);
+    // No legal moves, or a forced mate that deeper search won't change
+    result.complete = depth == limits_.depth || !result.best_move ||
+                      is_mate_score(score);
+    if (result.complete || out_of_budget())
+      break;
+  }
+  if (!result.best_move && aborted_) {
+    auto moves = Game::get_legal_moves(board);
+    if (!moves.empty())
+      result.best_move = moves.front();
+  }
+  result.nodes = nodes_;
+  result.seconds =
+      std::chrono::duration<double>(std::chrono::steady_clock::now() - start_)
+          .count();
+  return result;
+}
+
+bool Searcher::out_of_budget() const {
+  if (limits_.stop && limits_.stop->load(std::memory_order_relaxed))
+    return true;
+  if (limits_.nodes && nodes_ >= limits_.nodes)
+    return true;
+  if (limits_.seconds > 0) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_;
+    if (elapsed.count() >= limits_.seconds)
+      return true;
+  }
+  return false;
+}
+
+int Searcher::negamax(const Board &board, int depth, int ply, int alpha,
+                      int beta) {
+  // Clock reads are slow next to a node, so check limits every 256 nodes
+  if (++nodes_ % 256 == 0 && out_of_budget())
+    aborted_ = true;
+  if (aborted_)
+    return 0;
+
+  if (ply > 0) {
+    if (history_.repetitions() > 0)
+      return 0;
+    if (auto score = tablebase_score(board, ply))
+      return *score;
+  }
+  if (depth == 0)
+    return evaluate(board);
+
+  const int original_alpha = alpha;
+  std::optional<Move> hash_move;
+  if (auto entry = table_.probe(board.hash())) {
+    hash_move = entry->move;
+    const int score = score_from_table(entry->score, ply);
+    if (ply > 0 && entry->depth >= depth &&
+        (entry->bound == Bound::Exact ||
+         (entry->bound == Bound::Lower && score >= beta) ||
+         (entry->bound == Bound::Upper && score <= alpha)))
+      return score;
+  }
+
+  common::ArenaScope scope;
+  MovePicker picker(board, hash_move, killers_[ply]);
+  int best_score = -kInfinity;
+  std::optional<Move> best_move;
+  while (auto move = picker.next()) {
+    if (!is_legal_move(board, *move))
+      continue;
+    Board child = board;
+    child.make_move(*move);
+    history_.push(child);
+    const int score = -negamax(child, depth - 1, ply + 1, -beta, -alpha);
+    history_.pop();
+    if (aborted_)
+      return 0;
+
+    if (score > best_score) {
+      best_score = score;
+      best_move = move;
+      if (ply == 0)
+        root_best_ = move;
+    }
+    alpha = std::max(alpha, score);
+    if (alpha >= beta) {
+      auto &killers = killers_[ply];
+      if (!is_capture(board, *move) && killers[0] != move) {
+        killers[1] = killers[0];
+        killers[0] = move;
+      }
+      break;
+    }
+  }
+
+  if (!best_move) // checkmate or stalemate
+    return is_in_check(board) ? -(kMateScore - ply) : 0;
+
+  TranspositionTable::Entry entry;
+  entry.move = best_move;
+  entry.score = score_to_table(best_score, ply);
+  entry.depth = depth;
+  entry.bound = best_score >= beta             ? Bound::Lower
+                : best_score > original_alpha ? Bound::Exact
+                                              : Bound::Upper;
+  table_.store(board.hash(), entry);
+  return best_score;
+}
+
+int Searcher::evaluate(const Board &board) const {
+  PROFILE_SCOPE("evaluate");
+  return Game::material_balance(board) * 100;
+}
+
+std::optional<int> Searcher::tablebase_score(const Board &board,
+                                             int ply) const {
+  if (!tablebases_)
+    return {};
+  auto result = tablebases_->probe(board);
+  if (!result)
+    return {};
+  return result->outcome * (kMateScore - ply - result->plies);
+}
+
+std::vector<Move> Searcher::principal_variation(const Board &board,
+                                                int depth) const {
+  std::vector<Move> pv;
+  Board position = board;
+  for (int ply = 0; ply < depth; ply++) {
+    auto entry = table_.probe(position.hash());
+    if (!entry || !entry->move || !is_possible_move(position, *entry->move) ||
+        !is_legal_move(position, *entry->move))
+      break;
+    pv.push_back(*entry->move);
+    position.make_move(*entry->move);
+  }
+  return pv;
+}
+
+void Ponderer::start(const Board &board, const PositionHistory &history,
+                     const SearchLimits &limits,
+                     std::optional<Move> expected_reply) {
+  stop();
+  stop_ = false;
+  replies_.clear();
+  next_ = 0;
+  spent_nodes_ = 0;
+  spent_seconds_ = 0;
+  results_.clear();
+  limits_ = limits;
+  limits_.stop = &stop_;
+
+  auto moves = Game::get_legal_moves(board);
+  auto expected = std::find(moves.begin(), moves.end(), expected_reply);
+  if (expected != moves.end())
+    std::rotate(moves.begin(), expected, expected + 1);
+  for (const Move &move : moves) {
+    Board reply = board;
+    reply.make_move(move);
+    PositionHistory reply_history = history;
+    if (reply_history.empty())
+      reply_history.push(board);
+    reply_history.push(reply);
+    replies_.emplace_back(reply, std::move(reply_history));
+  }
+}
+
+bool Ponderer::step(uint64_t max_nodes) {
+  if (next_ >= replies_.size() || stop_)
+    return false;
+  const auto &[board, history] = replies_[next_];
+  SearchLimits limits = limits_;
+  if (max_nodes) {
+    // The reply's own limits count across all of its slices
+    limits.nodes = limits_.nodes ? std::min(max_nodes, limits_.nodes -
+                                                           spent_nodes_)
+                                 : max_nodes;
+    if (limits_.seconds > 0)
+      limits.seconds = limits_.seconds - spent_seconds_;
+  }
+  SearchResult result = searcher_.search(board, history, limits);
+  spent_nodes_ += result.nodes;
+  spent_seconds_ += result.seconds;
+  if (stop_)
+    return false;
+  const bool out_of_budget =
+      !max_nodes || (limits_.nodes && spent_nodes_ >= limits_.nodes) ||
+      (limits_.seconds > 0 && spent_seconds_ >= limits_.seconds);
+  if (!result.complete && !out_of_budget)
+    return true;
+
+  result.nodes = spent_nodes_;
+  result.seconds = spent_seconds_;
+  results_[board.hash()] = std::move(result);
+  next_++;
+  spent_nodes_ = 0;
+  spent_seconds_ = 0;
+  return next_ < replies_.size();
+}
+
+void Ponderer::run_in_background() {
+  // Only join an earlier thread; the queued replies still need searching
+  stop();
+  stop_ = false;
+  thread_ = std::thread([this] {
+    while (step()) {
+    }
+  });
+}
+
+void Ponderer::wait() {
+  if (thread_.joinable())
+    thread_.join();
+}
+
+void Ponderer::stop() {
+  stop_ = true;
+  if (thread_.joinable())
+    thread_.join();
+}
+
+const SearchResult *Ponderer::find(const Board &board) const {
+  auto it = results_.find(board.hash());
+  return it == results_.end() ? nullptr : &it->second;
+}
+
+std::optional<Move> AlphaBetaBot::select_move(Board &board,
+                                              const PositionHistory &history) {
+  ponderer_->stop();
+  if (const SearchResult *pondered = ponderer_->find(board)) {
+    ponder_hits_++;
+    last_result_ = *pondered;
+  } else {
+    last_result_ = searcher_->search(board, history, limits_);
+  }
+  return last_result_.best_move;
+}
+
+void AlphaBetaBot::ponder(const Board &board, const PositionHistory &history,
+                          bool background) {
+  // The principal variation of our last search starts with our move
+  std::optional<Move> expected_reply;
+  if (last_result_.pv.size() >= 2)
+    expected_reply = last_result_.pv[1];
+  ponderer_->start(board, history, limits_, expected_reply);
+  if (background)
+    ponderer_->run_in_background();
+}
+
+} // namespace sovereign_chess
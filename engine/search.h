@@ -0,0 +1,206 @@
+// Iterative deepening alpha-beta search with a shared transposition table
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "move_picker.h"
+#include "position_history.h"
+#include "sovereign_chess.h"
+#include "tablebase.h"
+
+namespace sovereign_chess {
+
+/** Scores are in hundredths of a piece for the player to move. Checkmate in
+ * n plies from the root scores kMateScore - n, and being mated the negation.
+ */
+constexpr int kMateScore = 30000;
+constexpr int kMaxPly = 128;
+constexpr bool is_mate_score(int score) {
+  return score > kMateScore - kMaxPly || score < -kMateScore + kMaxPly;
+}
+
+/** Search results by position hash, shared by any number of searching
+ * threads without locks. Each slot stores the hash xor its data, so a slot
+ * torn by concurrent writers fails the hash check on probe and reads as a
+ * miss. New results always replace old ones.
+ */
+class TranspositionTable {
+public:
+  enum class Bound : uint8_t { None, Upper, Lower, Exact };
+  struct Entry {
+    std::optional<Move> move;
+    int score = 0; // mate scores counted from this position
+    int depth = 0;
+    Bound bound = Bound::None;
+  };
+
+  // Rounded down to a power of two slots
+  explicit TranspositionTable(std::size_t megabytes = 16);
+
+  std::optional<Entry> probe(uint64_t hash) const;
+  void store(uint64_t hash, const Entry &entry);
+  void clear();
+
+private:
+  struct Slot {
+    std::atomic<uint64_t> check; // hash ^ data
+    std::atomic<uint64_t> data;
+  };
+  std::unique_ptr<Slot[]> slots_;
+  std::size_t mask_;
+};
+
+// Any limit reached stops the search; zero means no limit
+struct SearchLimits {
+  int depth = kMaxPly - 1;
+  uint64_t nodes = 0;
+  double seconds = 0;
+  const std::atomic<bool> *stop = nullptr; // set by another thread
+};
+
+struct SearchResult {
+  std::optional<Move> best_move; // empty if there are no legal moves
+  int score = 0;
+  int depth = 0; // of the last completed iteration
+  // Searched to the depth limit, or to a result deeper search can't change
+  bool complete = false;
+  uint64_t nodes = 0;
+  double seconds = 0;
+  std::vector<Move> pv; // principal variation, from the table
+};
+
+/** One search thread. Several searchers may share a table, and each can run
+ * one search at a time.
+ */
+class Searcher {
+public:
+  // Positions in the tablebases, if given, score exactly without searching
+  explicit Searcher(TranspositionTable &table,
+                    const Tablebases *tablebases = nullptr)
+      : table_(table), tablebases_(tablebases), killers_(kMaxPly) {}
+
+  // Called with the result of each completed depth
+  using Progress = std::function<void(const SearchResult &)>;
+
+  /** history holds the game so far, ending with board. Positions that repeat
+   * one from earlier in the game or search line score as draws. Returns the
+   * deepest completed iteration, or the best move found so far if the first
+   * didn't complete.
+   */
+  SearchResult search(const Board &board, const PositionHistory &history,
+                      const SearchLimits &limits,
+                      const Progress &progress = {});
+
+private:
+  int negamax(const Board &board, int depth, int ply, int alpha, int beta);
+  int evaluate(const Board &board) const;
+  std::optional<int> tablebase_score(const Board &board, int ply) const;
+  bool out_of_budget() const;
+  std::vector<Move> principal_variation(const Board &board, int depth) const;
+
+  TranspositionTable &table_;
+  const Tablebases *tablebases_;
+  std::vector<MovePicker::Killers> killers_; // by ply
+  PositionHistory history_;                  // game and search line
+  SearchLimits limits_;
+  std::chrono::steady_clock::time_point start_;
+  uint64_t nodes_ = 0;
+  bool aborted_ = false;
+  std::optional<Move> root_best_; // of the current iteration
+};
+
+/** Searches the positions after each of the opponent's replies while they
+ * think, expected reply first. Finished searches are kept by position, and
+ * everything searched stays in the table, so the search after the actual
+ * reply is quick either way. Runs on a background thread, or in short
+ * slices through step() where there are no threads.
+ */
+class Ponderer {
+public:
+  Ponderer(TranspositionTable &table, const Tablebases *tablebases = nullptr)
+      : searcher_(table, tablebases) {}
+  ~Ponderer() { stop(); }
+
+  /** Stops any earlier pondering and queues the replies from board, the
+   * position after our move. history ends with board. Each reply is
+   * searched to limits, or until stop().
+   */
+  void start(const Board &board, const PositionHistory &history,
+             const SearchLimits &limits,
+             std::optional<Move> expected_reply = {});
+  /** Searches the next queued reply. With max_nodes set, stops after about
+   * that many nodes instead, and the next call resumes the same reply from
+   * what the table kept. False once every reply is searched.
+   */
+  bool step(uint64_t max_nodes = 0);
+  // Steps on a background thread until done or stopped
+  void run_in_background();
+  // Joins the background thread once every reply is searched
+  void wait();
+  // Interrupts the search in progress and joins the background thread
+  void stop();
+
+  // The finished search of board, if it was one of the pondered replies.
+  // Call after stop().
+  const SearchResult *find(const Board &board) const;
+
+private:
+  Searcher searcher_;
+  std::vector<std::pair<Board, PositionHistory>> replies_; // to search
+  std::size_t next_ = 0;
+  SearchLimits limits_;
+  uint64_t spent_nodes_ = 0; // on replies_[next_], over earlier slices
+  double spent_seconds_ = 0;
+  std::unordered_map<uint64_t, SearchResult> results_; // by position hash
+  std::atomic<bool> stop_ = false;
+  std::thread thread_;
+};
+
+// A searcher with its own table, playing to fixed limits
+class AlphaBetaBot {
+public:
+  explicit AlphaBetaBot(const SearchLimits &limits = {.depth = 3},
+                        const Tablebases *tablebases = nullptr,
+                        std::size_t table_megabytes = 16)
+      : limits_(limits),
+        table_(std::make_unique<TranspositionTable>(table_megabytes)),
+        searcher_(std::make_unique<Searcher>(*table_, tablebases)),
+        ponderer_(std::make_unique<Ponderer>(*table_, tablebases)) {}
+
+  // Stops pondering first, and answers at once if board was pondered
+  std::optional<Move> select_move(Board &board,
+                                  const PositionHistory &history = {});
+
+  /** Ponders the opponent's replies from board, the position after our
+   * last move. In the background if requested, otherwise call
+   * ponder_step() until it returns false.
+   */
+  void ponder(const Board &board, const PositionHistory &history = {},
+              bool background = true);
+  bool ponder_step(uint64_t max_nodes = 0) {
+    return ponderer_->step(max_nodes);
+  }
+  // Blocks until background pondering has searched every reply
+  void wait_for_ponder() { ponderer_->wait(); }
+
+  const SearchResult &last_result() const { return last_result_; }
+  // Moves answered from a pondered search
+  int ponder_hits() const { return ponder_hits_; }
+
+private:
+  SearchLimits limits_;
+  std::unique_ptr<TranspositionTable> table_;
+  std::unique_ptr<Searcher> searcher_;
+  std::unique_ptr<Ponderer> ponderer_;
+  SearchResult last_result_;
+  int ponder_hits_ = 0;
+};
+
+} // namespace sovereign_chess
@@ -0,0 +1,268 @@
+// Plays bots against each other across threads and reports results and
+// throughput.
+//
+// Usage: self_play [--games N] [--threads N] [--seed N] [--bot1 NAME]
+//                  [--bot2 NAME] [--openings FILE] [--random-plies N]
+//                  [--max-plies N] [--output FILE] [--mcts-playouts N]
+//                  [--mcts-threads N] [--mcts-root-parallel 0|1]
+//                  [--alphabeta-depth N] [--tablebase FILE]...
+// Bots: random, minimax, mcts, alphabeta. Openings are read one FEN per line
+// and assigned to games round-robin; otherwise every game starts from the
+// initial position. Built with PROFILE=1, it also reports time spent in the
+// engine's timed scopes.
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <string>
+#include <variant>
+
+#include "alloc_counter.h"
+#include "generic_bots.h"
+#include "position_history.h"
+#include "profile.h"
+#include "rng.h"
+#include "search.h"
+#include "sovereign_chess.h"
+#include "tablebase.h"
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+using AnyBot = std::variant<RandomBot, MinimaxBot, MctsBot, AlphaBetaBot>;
+
+struct Options {
+  int games = 100;
+  unsigned threads = std::thread::hardware_concurrency();
+  uint64_t seed = 1;
+  std::string bot1 = "random";
+  std::string bot2 = "random";
+  std::vector<std::string> openings = {kInitialFen};
+  int random_plies = 0;
+  int max_plies = 500;
+  std::string output;
+  MctsOptions mcts;
+  SearchLimits alphabeta = {.depth = 3};
+  std::shared_ptr<Tablebases> tablebases = std::make_shared<Tablebases>();
+};
+
+std::optional<AnyBot> make_bot(const std::string &name, uint64_t seed,
+                               const Options &options) {
+  if (name == "random")
+    return RandomBot{seed};
+  if (name == "minimax")
+    return MinimaxBot{options.tablebases.get()};
+  if (name == "mcts") {
+    MctsOptions mcts = options.mcts;
+    mcts.seed = seed;
+    return MctsBot{mcts};
+  }
+  if (name == "alphabeta")
+    return AlphaBetaBot{options.alphabeta, options.tablebases.get()};
+  return {};
+}
+
+enum class Result { Player1Wins, Player2Wins, Draw };
+
+struct GameRecord {
+  Result result = Result::Draw;
+  bool repetition = false; // drawn by threefold repetition
+  int plies = 0;
+  uint64_t seed = 0;
+  long mcts_playouts = 0;
+  double mcts_seconds = 0;
+};
+
+GameRecord play_game(const Options &options, int index) {
+  GameRecord record;
+  // The game seed determines the opening plies and the bot seeds, so any game
+  // can be replayed from its seed alone
+  record.seed = options.seed + index;
+  common::Rng rng(record.seed);
+
+  Board board =
+      Board::from_fen(options.openings[index % options.openings.size()]);
+
+  // Randomized openings so that deterministic bots don't replay one game
+  for (int ply = 0; ply < options.random_plies; ply++) {
+    auto legal_moves = Game::get_legal_moves(board);
+    if (legal_moves.empty())
+      break;
+    board.make_move(legal_moves[rng.below(legal_moves.size())]);
+  }
+
+  AnyBot bots[2] = {*make_bot(options.bot1, rng(), options),
+                    *make_bot(options.bot2, rng(), options)};
+  PositionHistory history;
+  history.push(board);
+  while (record.plies < options.max_plies) {
+    AnyBot &bot = bots[static_cast<int>(board.player_to_move())];
+    auto move = std::visit(
+        [&](auto &b) {
+          if constexpr (requires { b.select_move(board, history); })
+            return b.select_move(board, history);
+          else
+            return b.select_move(board);
+        },
+        bot);
+    if (auto *mcts = std::get_if<MctsBot>(&bot)) {
+      record.mcts_playouts += mcts->last_playouts();
+      record.mcts_seconds += mcts->last_seconds();
+    }
+    if (!move) {
+      if (is_in_check(board))
+        record.result = board.player_to_move() == Player::Player1
+                            ? Result::Player2Wins
+                            : Result::Player1Wins;
+      return record;
+    }
+    board.make_move(*move);
+    record.plies++;
+    history.push(board);
+    if (history.is_threefold()) {
+      record.repetition = true;
+      return record;
+    }
+  }
+  return record; // move cap reached, draw
+}
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (i + 1 >= argc) {
+      std::cerr << "Missing value for " << arg << "\n";
+      return {};
+    }
+    std::string value = argv[++i];
+    if (arg == "--games")
+      options.games = std::stoi(value);
+    else if (arg == "--threads")
+      options.threads = std::stoi(value);
+    else if (arg == "--seed")
+      options.seed = std::stoull(value);
+    else if (arg == "--bot1")
+      options.bot1 = value;
+    else if (arg == "--bot2")
+      options.bot2 = value;
+    else if (arg == "--random-plies")
+      options.random_plies = std::stoi(value);
+    else if (arg == "--max-plies")
+      options.max_plies = std::stoi(value);
+    else if (arg == "--output")
+      options.output = value;
+    else if (arg == "--mcts-playouts")
+      options.mcts.playouts = std::stoi(value);
+    else if (arg == "--mcts-threads")
+      options.mcts.threads = std::stoi(value);
+    else if (arg == "--mcts-root-parallel")
+      options.mcts.parallelism = std::stoi(value)
+                                     ? MctsOptions::Parallelism::Root
+                                     : MctsOptions::Parallelism::Tree;
+    else if (arg == "--alphabeta-depth")
+      options.alphabeta.depth = std::stoi(value);
+    else if (arg == "--tablebase") {
+      if (!options.tablebases->load(value)) {
+        std::cerr << "Can't load tablebase " << value << "\n";
+        return {};
+      }
+    } else if (arg == "--openings") {
+      std::ifstream in(value);
+      options.openings.clear();
+      for (std::string line; std::getline(in, line);) {
+        if (!line.empty())
+          options.openings.push_back(line);
+      }
+      if (options.openings.empty()) {
+        std::cerr << "No openings in " << value << "\n";
+        return {};
+      }
+    } else {
+      std::cerr << "Unknown option " << arg << "\n";
+      return {};
+    }
+  }
+  for (const auto &name : {options.bot1, options.bot2}) {
+    if (!make_bot(name, 0, options)) {
+      std::cerr << "Unknown bot " << name << "\n";
+      return {};
+    }
+  }
+  return options;
+}
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  std::vector<GameRecord> records(options->games);
+  common::ThreadPool pool(options->threads > 1 ? options->threads - 1 : 0);
+
+  const uint64_t allocations_before = common::allocation_count();
+  auto start = std::chrono::steady_clock::now();
+  pool.parallel_for(records.size(), [&](std::size_t i) {
+    records[i] = play_game(*options, i);
+  });
+  std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+  const uint64_t allocations =
+      common::allocation_count() - allocations_before;
+
+  int wins[3] = {0, 0, 0};
+  int repetitions = 0;
+  long total_plies = 0;
+  long mcts_playouts = 0;
+  double mcts_seconds = 0;
+  int min_plies = std::numeric_limits<int>::max();
+  int max_plies = 0;
+  for (const auto &record : records) {
+    wins[static_cast<int>(record.result)]++;
+    repetitions += record.repetition;
+    total_plies += record.plies;
+    min_plies = std::min(min_plies, record.plies);
+    max_plies = std::max(max_plies, record.plies);
+    mcts_playouts += record.mcts_playouts;
+    mcts_seconds += record.mcts_seconds;
+  }
+
+  if (!options->output.empty()) {
+    std::ofstream out(options->output);
+    out << "game,seed,result,plies\n";
+    for (std::size_t i = 0; i < records.size(); i++) {
+      const char *result[] = {"1-0", "0-1", "1/2-1/2"};
+      out << i << "," << records[i].seed << ","
+          << result[static_cast<int>(records[i].result)] << ","
+          << records[i].plies << "\n";
+    }
+  }
+
+  std::cout << options->bot1 << " vs " << options->bot2 << ": "
+            << options->games << " games on " << pool.concurrency()
+            << " threads\n";
+  std::cout << "Player 1 wins: " << wins[0] << " Player 2 wins: " << wins[1]
+            << " Draws: " << wins[2] << " (" << repetitions
+            << " by repetition)\n";
+  if (!records.empty())
+    std::cout << "Plies: mean "
+              << static_cast<double>(total_plies) / records.size() << " min "
+              << min_plies << " max " << max_plies << "\n";
+  std::cout << "Time: " << elapsed.count() << "s, "
+            << options->games / elapsed.count() << " games/s, "
+            << total_plies / elapsed.count() << " plies/s" << std::endl;
+  std::cout << "Allocations: " << allocations << ", "
+            << static_cast<double>(allocations) / std::max(total_plies, 1L)
+            << " per ply" << std::endl;
+  if (mcts_playouts > 0)
+    std::cout << "MCTS: " << mcts_playouts << " playouts, "
+              << mcts_playouts / mcts_seconds << " playouts/s per search"
+              << std::endl;
+  common::Profiler::instance().report(std::cout);
+  return 0;
+}
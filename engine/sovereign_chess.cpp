@@ -1,99 +1,187 @@
 #include "sovereign_chess.h"
 
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+
+#include "profile.h"
+
 namespace sovereign_chess {
 
 using common::name_to_piece_type;
 using PT = common::PieceType;
 // ----------------------------- Move engine ---------------------------
 
-bool in_range(int coord) { return coord >= 0 && coord <= 15; }
-bool in_range(const Coord &coord) {
-  return in_range(coord.rank) && in_range(coord.file);
-}
-
-// Precondition: square must be colored
-// TODO optimize, constexpr
-Coord other_square_of_same_color(const Coord &coord) {
-  // Compute map of coords by color
-  std::unordered_map<Color, std::vector<Coord>> coords_by_color;
-  for (const auto &[coord, color] : colored_squares) {
-    coords_by_color[color].push_back(coord);
-  }
-
-  // Compute map of square->square for all colors
-  std::unordered_map<Coord, Coord, common::coord_hash> other_square;
-  for (const auto &[color, coords] : coords_by_color) {
-    other_square[coords[0]] = coords[1];
-    other_square[coords[1]] = coords[0];
-  }
-
-  return other_square.at(coord);
-}
-
 // Return false if move violates coloring rules of target square.
-// Precondition: piece exists at source square
-bool check_target_square_color(const Board &board, const Coord &src,
-                               const Coord &dest) {
-  Color piece_color = board.piece_at(src).color;
-
-  std::optional<Color> dest_color = square_color(dest);
+bool check_target_square_color(const Board &board, Color piece_color,
+                               Square dest) {
+  Color dest_color = kSquareColors[dest];
 
   // No rules if target square is uncolored
-  if (!dest_color)
+  if (dest_color == Color::Empty)
     return true;
 
   // may not land on square of same color
-  if (*dest_color == piece_color)
+  if (dest_color == piece_color)
     return false;
 
   // If this is a capture, no further checking needed
-  if (board.piece_at(dest).color != Color::Empty)
+  if (board.packed_at(dest) != kNoPiece)
     return true;
 
   // Cannot land on colored square if other square of same color has piece
-  if (board.piece_at(other_square_of_same_color(dest)).color != Color::Empty)
-    return false;
+  return board.packed_at(kOtherSquareOfSameColor[dest]) == kNoPiece;
+}
+
+// ----------------------------- Move tables ---------------------------
+
+// Same order as the common:: step lists, so generation order is unchanged
+constexpr std::array<Coord, 4> kOrthogonal = {
+    {{1, 0}, {0, 1}, {0, -1}, {-1, 0}}};
+constexpr std::array<Coord, 4> kDiagonal = {
+    {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}}};
+constexpr std::array<Coord, 8> kKnight = {
+    {{1, 2}, {-1, 2}, {1, -2}, {-1, -2}, {2, 1}, {2, -1}, {-2, 1}, {-2, -1}}};
+
+constexpr std::array<int, 4> to_x88_steps(const std::array<Coord, 4> &steps) {
+  std::array<int, 4> x88_steps{};
+  for (std::size_t i = 0; i < steps.size(); i++)
+    x88_steps[i] = x88_step(steps[i]);
+  return x88_steps;
+}
+
+constexpr auto kOrthogonalX88 = to_x88_steps(kOrthogonal);
+constexpr auto kDiagonalX88 = to_x88_steps(kDiagonal);
 
-  return true;
+constexpr bool on_board(int rank, int file) {
+  return rank >= 0 && rank < 16 && file >= 0 && file < 16;
 }
 
+// Twice the distance to the centerline, to stay in integers
+constexpr int center_distance(int coord) {
+  return coord * 2 > 15 ? coord * 2 - 15 : 15 - coord * 2;
+}
+
+// Target squares from a square, in step order
+struct TargetList {
+  std::array<Square, 8> squares{};
+  uint8_t size = 0;
+
+  constexpr void push_back(Square square) { squares[size++] = square; }
+  constexpr const Square *begin() const { return squares.data(); }
+  constexpr const Square *end() const { return squares.data() + size; }
+};
+
+template <std::size_t... N>
+constexpr std::array<TargetList, 256>
+leaper_targets(const std::array<Coord, N> &...step_lists) {
+  std::array<TargetList, 256> targets{};
+  for (int square = 0; square < 256; square++) {
+    Coord src = to_coord(square);
+    auto add_steps = [&](const auto &steps) {
+      for (const Coord &step : steps) {
+        int rank = src.rank + step.rank, file = src.file + step.file;
+        if (on_board(rank, file))
+          targets[square].push_back(to_square(Coord{rank, file}));
+      }
+    };
+    (add_steps(step_lists), ...);
+  }
+  return targets;
+}
+
+constexpr auto kKnightTargets = leaper_targets(kKnight);
+constexpr auto kKingTargets = leaper_targets(kDiagonal, kOrthogonal);
+
+// Squares are never 0 for a two-step advance, so it doubles as "none"
+constexpr Square kNoDoublePush = 0;
+
+struct PawnPush {
+  Square dest;
+  Square double_dest; // From the outer two rings, else kNoDoublePush
+};
+
+// Pawn targets allowed by the centerline rule
+struct PawnTargets {
+  std::array<PawnPush, 4> pushes{};
+  uint8_t num_pushes = 0;
+  TargetList captures;
+};
+
+constexpr auto kPawnTargets = [] {
+  std::array<PawnTargets, 256> targets{};
+  for (int square = 0; square < 256; square++) {
+    Coord src = to_coord(square);
+    // Pawns must get closer to at least one centerline
+    auto closer = [&](int rank, int file) {
+      return center_distance(rank) < center_distance(src.rank) ||
+             center_distance(file) < center_distance(src.file);
+    };
+    PawnTargets &t = targets[square];
+    for (const Coord &step : kOrthogonal) {
+      int rank = src.rank + step.rank, file = src.file + step.file;
+      if (!closer(rank, file))
+        continue;
+      PawnPush push{to_square(Coord{rank, file}), kNoDoublePush};
+      if (!on_board(src.rank - 2 * step.rank, src.file - 2 * step.file))
+        push.double_dest = to_square(Coord{rank + step.rank, file + step.file});
+      t.pushes[t.num_pushes++] = push;
+    }
+    for (const Coord &step : kDiagonal) {
+      int rank = src.rank + step.rank, file = src.file + step.file;
+      // Edge pawns can get closer to one centerline while leaving the board
+      if (on_board(rank, file) && closer(rank, file))
+        t.captures.push_back(to_square(Coord{rank, file}));
+    }
+  }
+  return targets;
+}();
+
 // Knight, king
+template <MoveKinds kKinds, typename Moves>
 void fill_possible_nonrepeating_moves(const Board &board,
-                                      const std::vector<Coord> &relative_moves,
-                                      const Coord &src,
-                                      std::vector<Move> &moves) {
-  for (const Coord &relative : relative_moves) {
-    Coord target = src + relative;
-    if (in_range(target) && check_target_square_color(board, src, target) &&
-        (board.piece_at(target).color == Color::Empty ||
-         is_enemy_color(board, board.piece_at(target).color))) {
-      moves.push_back({src, target});
+                                      const TargetList &targets, Square src,
+                                      Moves &moves) {
+  const Color color = color_of(board.packed_at(src));
+  for (Square target : targets) {
+    PackedPiece target_p = board.packed_at(target);
+    if (!(kKinds & (target_p == kNoPiece ? kQuiets : kCaptures)))
+      continue;
+    if (check_target_square_color(board, color, target) &&
+        (target_p == kNoPiece || is_enemy_color(board, color_of(target_p)))) {
+      moves.push_back({to_coord(src), to_coord(target)});
     }
   }
 }
 
 // Bishop, queen, rook
+template <MoveKinds kKinds, typename Moves>
 void fill_possible_repeating_moves(const Board &board,
-                                   const std::vector<Coord> &relative_moves,
-                                   const Coord &src, std::vector<Move> &moves) {
-  for (const Coord &relative : relative_moves) {
-    Coord target = src;
+                                   const std::array<int, 4> &steps, Square src,
+                                   Moves &moves) {
+  const Color color = color_of(board.packed_at(src));
+  for (int step : steps) {
+    int target_x88 = to_x88(src);
     while (true) {
-      target = target + relative;
+      target_x88 += step;
       // if we're off board, stop
-      if (!in_range(target)) {
+      if (off_board(target_x88))
         break;
-      } else if (board.piece_at(target).color == Color::Empty) {
-        if (check_target_square_color(board, src, target)) {
+      Square target = from_x88(target_x88);
+      PackedPiece target_p = board.packed_at(target);
+      if (target_p == kNoPiece) {
+        if (kKinds & kQuiets &&
+            check_target_square_color(board, color, target)) {
           // Empty square that we can move to, continue
-          moves.push_back({src, target});
+          moves.push_back({to_coord(src), to_coord(target)});
         }
         // if it's empty but we fail color checks, keep going
-      } else if (is_enemy_color(board, board.piece_at(target).color) &&
-                 check_target_square_color(board, src, target)) {
+      } else if (is_enemy_color(board, color_of(target_p)) &&
+                 check_target_square_color(board, color, target)) {
         // Enemy piece, and we're not landing on our own color, so record move
         // but stop
-        moves.push_back({src, target});
+        if (kKinds & kCaptures)
+          moves.push_back({to_coord(src), to_coord(target)});
         break;
       } else {
         // Not empty and not capturable, stop
@@ -103,128 +191,299 @@ void fill_possible_repeating_moves(const Board &board,
   }
 }
 
-void fill_possible_pawn_moves(const Board &board, const Coord &src,
-                              std::vector<Move> &moves) {
-  // Non-capture
-  for (const auto &step : common::kOrthogonalSteps) {
-    Coord dest = src + step;
-    // Check that we're getting closer to the center
-    if (std::abs(dest.rank - 7.5) < std::abs(src.rank - 7.5) ||
-        std::abs(dest.file - 7.5) < std::abs(src.file - 7.5)) {
-      if (board.piece_at(dest).color != Color::Empty)
-        continue; // can't capture
-
-      if (check_target_square_color(board, src, dest)) {
-        moves.push_back(Move{src, dest});
-      }
+template <MoveKinds kKinds, typename Moves>
+void fill_possible_pawn_moves(const Board &board, Square src, Moves &moves) {
+  const Color color = color_of(board.packed_at(src));
+  const PawnTargets &targets = kPawnTargets[src];
 
-      // If we weren't blocked, try two-step advance
-      Coord two_step = step + step;
-      if (!in_range(src - two_step) && // Check if we're on outer two rings
-          board.piece_at(src + two_step).color == Color::Empty &&
-          check_target_square_color(board, src, src + two_step)) {
-        moves.push_back(Move{src, src + two_step});
-      }
-    }
+  // Non-capture
+  for (int i = 0; i < (kKinds & kQuiets ? targets.num_pushes : 0); i++) {
+    const PawnPush &push = targets.pushes[i];
+    if (board.packed_at(push.dest) != kNoPiece)
+      continue; // can't capture
+
+    if (check_target_square_color(board, color, push.dest))
+      moves.push_back(Move{to_coord(src), to_coord(push.dest)});
+
+    // If we weren't blocked, try two-step advance
+    if (push.double_dest != kNoDoublePush &&
+        board.packed_at(push.double_dest) == kNoPiece &&
+        check_target_square_color(board, color, push.double_dest))
+      moves.push_back(Move{to_coord(src), to_coord(push.double_dest)});
   }
 
   // Capture
-  for (const auto &step : common::kDiagonalSteps) {
-    Coord dest = src + step;
-    const Piece &target_p = board.piece_at(dest);
-    // Check that we're getting closer to a centerline
-    if ((std::abs(dest.rank - 7.5) < std::abs(src.rank - 7.5) ||
-         std::abs(dest.file - 7.5) < std::abs(src.file - 7.5)) &&
-        board.controlling_player(target_p.color) ==
-            other_player(board.player_to_move()) &&
-        check_target_square_color(board, src, dest)) {
-      moves.push_back(Move{src, dest});
+  if (!(kKinds & kCaptures))
+    return;
+  const Player opponent = other_player(board.player_to_move());
+  for (Square dest : targets.captures) {
+    Color target_color = color_of(board.packed_at(dest));
+    if (board.controlling_player(target_color) == opponent &&
+        check_target_square_color(board, color, dest)) {
+      moves.push_back(Move{to_coord(src), to_coord(dest)});
     }
   }
 }
 
-Board::Board() {
-  for (int rank = 15; rank >= 0; rank--) {
-    for (int file = 0; file < 16; file++) {
-      pieces_[rank][file] = Piece{PieceType::Invalid, Color::Empty};
-    }
-  }
+Board::Board() { squares_.fill(kNoPiece); }
+
+// Kings otherwise move one square, so moving two files is castling
+bool is_castle(const Board &board, const Move &move) {
+  return board.piece_at(move.src).type == PT::King &&
+         std::abs(move.dest.file - move.src.file) == 2;
 }
 
 // Move is assumed to be legal
 void Board::make_move(const Move &move) {
+  PROFILE_SCOPE("make_move");
+  const Player player = player_to_move();
+  const Player opponent = other_player(player);
+
+  const Square src = to_square(move.src);
+  const Square dest = to_square(move.dest);
+
+  // Defection replaces the king with one of the new color, which the player
+  // now owns
+  if (move.is_defection()) {
+    halfmove_clock()++;
+    set_square(src, pack_piece(Piece{PT::King, move.defect_color}));
+    owned_color(player) = move.defect_color;
+    if (player == Player::Player2)
+      fullmove_number()++;
+    player_to_move() = opponent;
+    return;
+  }
+
+  // Castle rights are lost when the king moves, or when anything moves from or
+  // onto a rook origin square
+  if (move.src == king_origin(player)) {
+    castle_right(player, Castle::Kingside) = false;
+    castle_right(player, Castle::Queenside) = false;
+  }
+  for (Player p : {player, opponent}) {
+    for (Castle side : {Castle::Kingside, Castle::Queenside}) {
+      if (move.src == rook_origin(p, side) || move.dest == rook_origin(p, side))
+        castle_right(p, side) = false;
+    }
+  }
+
+  const bool castle = is_castle(*this, move);
+
+  // Halfmove clock resets on captures and pawn moves
+  if (type_of(squares_[src]) == PT::Pawn || squares_[dest] != kNoPiece)
+    halfmove_clock() = 0;
+  else
+    halfmove_clock()++;
+
   // Basic move
-  piece_at(move.dest) = piece_at(move.src);
-  piece_at(move.src) = Piece{};
+  PackedPiece piece = squares_[src];
+  set_square(src, kNoPiece);
 
   // Promotion
-  if (move.promotion_type != PieceType::Invalid) {
-    piece_at(move.dest).type = move.promotion_type;
+  if (move.promotion_type != PieceType::Invalid)
+    piece = pack_piece(Piece{move.promotion_type, color_of(piece)});
+  set_square(dest, piece);
+
+  // Castling also moves the rook onto the square the king crossed
+  if (castle) {
+    Castle side =
+        move.dest.file > move.src.file ? Castle::Kingside : Castle::Queenside;
+    Square rook = to_square(rook_origin(player, side));
+    set_square((src + dest) / 2, squares_[rook]);
+    set_square(rook, kNoPiece);
   }
 
   // swap player
-  player_to_move() = other_player(player_to_move());
+  if (player == Player::Player2)
+    fullmove_number()++;
+  player_to_move() = opponent;
 }
 
 void Board::place_piece(const Piece &piece, const Coord &coord) {
-  pieces_[coord.rank][coord.file] = piece;
+  if (piece == Piece{} || is_valid_piece(piece))
+    set_square(to_square(coord), pack_piece(piece));
+}
+
+void Board::set_square(Square square, PackedPiece piece) {
+  assert(piece == kNoPiece || is_valid_piece(unpack_piece(piece)));
+  if (squares_[square] != kNoPiece) {
+    pieces_[static_cast<int>(color_of(squares_[square])) - 1].erase(square);
+    pieces_hash_ ^= piece_key(square, squares_[square]);
+  }
+  if (piece != kNoPiece) {
+    pieces_[static_cast<int>(color_of(piece)) - 1].insert(square);
+    pieces_hash_ ^= piece_key(square, piece);
+  }
+  squares_[square] = piece;
+}
+
+uint64_t Board::hash() const {
+  uint64_t hash = pieces_hash_;
+  if (player_to_move_ == Player::Player2)
+    hash ^= kPlayer2ToMoveKey;
+  for (int player = 0; player < 2; player++)
+    hash ^= owned_color_key(player, owned_color_[player]);
+  for (int i = 0; i < 4; i++) {
+    if (castle_rights_[i])
+      hash ^= castle_right_key(i);
+  }
+  return hash;
+}
+
+SquareSet Board::pieces(ColorMask colors) const {
+  SquareSet set;
+  for (int color = 1; color < 13; color++) {
+    if (colors >> color & 1)
+      set |= pieces_[color - 1];
+  }
+  return set;
 }
 
 Board Board::from_fen(std::string_view fen) {
   Board board;
   int rank = 15;
   int file = 0;
-  int segment = 0;
   int skip_accumulator = 0;
   std::optional<char> last_color = {};
-  for (const char &c : fen) {
-    if (segment == 0) {
-      if (rank < 0)
-        break;
-      if (c == '/') { // new rank
-        rank -= 1;
-        file = 0;
-        skip_accumulator = 0;
-      } else if (c == '~') {
-        // preious piece was promoted; we don't care
-      } else if (c == ' ') { // end of piece placement
-        segment = 1;
-      } else if ('0' <= c && c <= '9') { // skip empty spaces
-        skip_accumulator *= 10;
-        skip_accumulator += static_cast<int>(c - '0');
-      } else { // we have a piece
-        file += skip_accumulator;
-        skip_accumulator = 0;
-
-        if (last_color) {
-
-          Color color = name_to_color(*last_color);
-          PieceType type = name_to_piece_type(c);
+  std::size_t placement_end = std::min(fen.find(' '), fen.size());
+  for (const char &c : fen.substr(0, placement_end)) {
+    if (rank < 0)
+      break;
+    if (c == '/') { // new rank
+      rank -= 1;
+      file = 0;
+      skip_accumulator = 0;
+    } else if (c == '~') {
+      // preious piece was promoted; we don't care
+    } else if ('0' <= c && c <= '9') { // skip empty spaces
+      skip_accumulator *= 10;
+      skip_accumulator += static_cast<int>(c - '0');
+    } else { // we have a piece
+      file += skip_accumulator;
+      skip_accumulator = 0;
+
+      if (last_color) {
+
+        Color color = name_to_color(*last_color);
+        PieceType type = name_to_piece_type(c);
+        // Unknown letters and squares past the edge are skipped
+        if (file < 16)
           board.place_piece(Piece{type, color}, Coord{rank, file});
 
-          file++;
-          last_color = {};
-        } else {
-          last_color = c;
-        }
+        file++;
+        last_color = {};
+      } else {
+        last_color = c;
       }
-    } else if (segment == 1) {
-      if (c == 'b')
-        // TODO handle colors
-        board.player_to_move() = Player::Player2;
     }
+  }
 
-    // TODO castle rights
+  std::istringstream fields{std::string(fen.substr(placement_end))};
+  std::string active_color, owned_colors, castle_rights;
+  int halfmove_clock, fullmove_number;
+  fields >> active_color >> owned_colors >> castle_rights;
+  if (fields >> halfmove_clock)
+    board.halfmove_clock() = halfmove_clock;
+  if (fields >> fullmove_number)
+    board.fullmove_number() = fullmove_number;
+
+  if (owned_colors.size() == 2) {
+    board.owned_color(Player::Player1) = name_to_color(owned_colors[0]);
+    board.owned_color(Player::Player2) = name_to_color(owned_colors[1]);
+  }
+  if (!active_color.empty() &&
+      name_to_color(active_color[0]) == board.owned_color(Player::Player2))
+    board.player_to_move() = Player::Player2;
+
+  if (!castle_rights.empty()) {
+    board.castle_rights_ = {false, false, false, false};
+    for (char c : castle_rights) {
+      if (c == 'K')
+        board.castle_right(Player::Player1, Castle::Kingside) = true;
+      else if (c == 'Q')
+        board.castle_right(Player::Player1, Castle::Queenside) = true;
+      else if (c == 'k')
+        board.castle_right(Player::Player2, Castle::Kingside) = true;
+      else if (c == 'q')
+        board.castle_right(Player::Player2, Castle::Queenside) = true;
+    }
+  } else {
+    // Remove castling rights if kings or rooks aren't in origin spaces
+    for (Player p : {Player::Player1, Player::Player2}) {
+      Color color = board.owned_color(p);
+      for (Castle side : {Castle::Kingside, Castle::Queenside}) {
+        if (board.piece_at(king_origin(p)) != Piece{PT::King, color} ||
+            board.piece_at(rook_origin(p, side)) != Piece{PT::Rook, color})
+          board.castle_right(p, side) = false;
+      }
+    }
   }
   return board;
 }
-// TODO tests
-std::string Board::to_fen() {
+
+bool is_valid_fen(std::string_view fen) {
+  const auto is_color = [](char c) {
+    return c != ' ' && name_to_color(c) != Color::Empty;
+  };
+  const auto is_number = [](const std::string &field) {
+    return !field.empty() && field.size() <= 9 &&
+           field.find_first_not_of("0123456789") == std::string::npos;
+  };
+  std::istringstream in{std::string(fen)};
+  std::string placement, active, owned, castle_rights, halfmove, fullmove,
+      extra;
+  if (!(in >> placement >> active >> owned) || active.size() != 1 ||
+      owned.size() != 2 || !is_color(active[0]) || !is_color(owned[0]) ||
+      !is_color(owned[1]) || owned[0] == owned[1] ||
+      (active[0] != owned[0] && active[0] != owned[1]))
+    return false;
+  // The remaining fields are optional, but must be well formed if present
+  if (in >> castle_rights && castle_rights != "-") {
+    for (std::size_t i = 0; i < castle_rights.size(); i++) {
+      const char c = castle_rights[i];
+      if (std::string_view("KQkq").find(c) == std::string_view::npos ||
+          castle_rights.find(c, i + 1) != std::string::npos)
+        return false;
+    }
+  }
+  if ((in >> halfmove && !is_number(halfmove)) ||
+      (in >> fullmove && !is_number(fullmove)) || in >> extra)
+    return false;
+  int ranks = 1, files = 0, skip = 0;
+  for (std::size_t i = 0; i < placement.size(); i++) {
+    const char c = placement[i];
+    if ('0' <= c && c <= '9') {
+      skip = skip * 10 + (c - '0');
+      if (skip > 16)
+        return false;
+      continue;
+    }
+    files += skip;
+    skip = 0;
+    if (c == '/') {
+      if (files != 16)
+        return false;
+      ranks++;
+      files = 0;
+    } else if (c != '~') {
+      if (i + 1 == placement.size() || !is_color(c) ||
+          name_to_piece_type(placement[i + 1]) == PieceType{})
+        return false;
+      i++;
+      files++;
+    }
+    if (files > 16)
+      return false;
+  }
+  return ranks == 16 && files + skip == 16;
+}
+
+std::string Board::to_fen() const {
   std::ostringstream ss;
   int gap = 0;
   for (int rank = 15; rank >= 0; rank--) {
     for (int file = 0; file < 16; file++) {
-      const auto &piece = piece_at({rank, file});
+      const Piece piece = piece_at({rank, file});
       if (piece.color != Color::Empty) {
         if (gap) {
           ss << gap;
@@ -246,96 +505,186 @@ std::string Board::to_fen() {
 
   ss << " ";
   ss << color_names.at(owned_color(player_to_move()));
+  ss << " ";
+  ss << color_names.at(owned_color(Player::Player1))
+     << color_names.at(owned_color(Player::Player2));
+
+  ss << " ";
+  std::string castle_rights;
+  if (castle_right(Player::Player1, Castle::Kingside))
+    castle_rights += 'K';
+  if (castle_right(Player::Player1, Castle::Queenside))
+    castle_rights += 'Q';
+  if (castle_right(Player::Player2, Castle::Kingside))
+    castle_rights += 'k';
+  if (castle_right(Player::Player2, Castle::Queenside))
+    castle_rights += 'q';
+  ss << (castle_rights.empty() ? "-" : castle_rights);
+
+  ss << " " << halfmove_clock() << " " << fullmove_number();
 
   return ss.str();
 }
 
 std::optional<Player> Board::controlling_player(Color color) const {
-  if (color == Color::Empty)
-    return {};
-  if (owned_color(Player::Player1) == color)
-    return Player::Player1;
-  if (owned_color(Player::Player2) == color)
-    return Player::Player2;
-  for (const auto &[coord, sq_color] : colored_squares) {
-    if (sq_color == color) {
-      const Piece &piece = piece_at(coord);
-      if (piece.color != Color::Empty) {
-        // Only one piece may occupy either colored square
-        // Will overflow stack if there's a cycle, but cycles are not allowed
-        return controlling_player(piece.color);
-      }
-    }
+  PROFILE_SCOPE("controlling_player");
+  // Follow the pieces on each color's squares until reaching an owned color.
+  // Only one piece may occupy either colored square. A chain longer than the
+  // number of colors is a cycle with no owned color in it (defection can
+  // leave one behind), which no one controls.
+  for (int length = 0; length < 13 && color != Color::Empty; length++) {
+    if (owned_color(Player::Player1) == color)
+      return Player::Player1;
+    if (owned_color(Player::Player2) == color)
+      return Player::Player2;
+    const auto &[first, second] = kColorSquares[static_cast<int>(color)];
+    color = color_of(squares_[first] != kNoPiece ? squares_[first]
+                                                  : squares_[second]);
   }
 
   // Neutral color
   return {};
 }
 
-std::vector<Move> get_possible_moves(const Board &board) {
+// Castling and defection, for the king of the player's owned color. Castling
+// out of or through check is ruled out with the other illegal moves.
+template <typename Moves>
+void fill_possible_king_special_moves(const Board &board, Square src,
+                                      ColorMask controlled, Moves &moves) {
+  const Player player = board.player_to_move();
+  const Color owned = board.owned_color(player);
+  if (color_of(board.packed_at(src)) != owned)
+    return;
+
+  // The king moves two files toward a rook of any controlled color
+  if (src == to_square(king_origin(player))) {
+    for (Castle side : {Castle::Kingside, Castle::Queenside}) {
+      const Square rook = to_square(rook_origin(player, side));
+      const PackedPiece rook_p = board.packed_at(rook);
+      if (!board.castle_right(player, side) || type_of(rook_p) != PT::Rook ||
+          !(controlled >> static_cast<int>(color_of(rook_p)) & 1))
+        continue;
+
+      const int step = rook > src ? 1 : -1;
+      bool blocked = false;
+      for (int square = src + step; square != rook; square += step)
+        blocked |= board.packed_at(square) != kNoPiece;
+      if (!blocked)
+        moves.push_back(Move{to_coord(src), to_coord(src + 2 * step)});
+    }
+  }
 
-  std::vector<Move> moves;
-  // Iterate over all pieces of current color //TODO(colors)
-  for (int rank = 0; rank < 16; rank++) {
-    for (int file = 0; file < 16; file++) {
-      Coord coord{rank, file};
-      const Piece &piece = board.piece_at(coord);
-      if (piece.color != Color::Empty &&
-          board.controlling_player(piece.color) == board.player_to_move()) {
-        // Pawns
-        if (piece.type == PieceType::Pawn) {
-          fill_possible_pawn_moves(board, coord, moves);
-        }
+  // The king may defect to any other color the player controls
+  for (int color = 1; color < 13; color++) {
+    if (controlled >> color & 1 && color != static_cast<int>(owned))
+      moves.push_back(
+          Move::defection(to_coord(src), static_cast<Color>(color)));
+  }
+}
 
-        // Kings
-        else if (piece.type == PieceType::King) {
-          fill_possible_nonrepeating_moves(board, common::kDiagonalSteps, coord,
-                                           moves);
-          fill_possible_nonrepeating_moves(board, common::kOrthogonalSteps,
-                                           coord, moves);
+ColorMask Board::controlled_colors(Player player) const {
+  ColorMask colors = 0;
+  for (int color = 1; color < 13; color++) {
+    if (controlling_player(static_cast<Color>(color)) == player)
+      colors |= 1 << color;
+  }
+  return colors;
+}
 
-          // TODO castling, regime change
-        }
+template <MoveKinds kKinds, typename Moves>
+void fill_possible_square_moves(const Board &board, Square square,
+                                ColorMask colors, Moves &moves) {
+  switch (type_of(board.packed_at(square))) {
+  case PieceType::Pawn:
+    fill_possible_pawn_moves<kKinds>(board, square, moves);
+    break;
+  case PieceType::King:
+    fill_possible_nonrepeating_moves<kKinds>(board, kKingTargets[square],
+                                             square, moves);
+    if (kKinds & kQuiets)
+      fill_possible_king_special_moves(board, square, colors, moves);
+    break;
+  case PieceType::Knight:
+    fill_possible_nonrepeating_moves<kKinds>(board, kKnightTargets[square],
+                                             square, moves);
+    break;
+  case PieceType::Bishop:
+    fill_possible_repeating_moves<kKinds>(board, kDiagonalX88, square, moves);
+    break;
+  case PieceType::Rook:
+    fill_possible_repeating_moves<kKinds>(board, kOrthogonalX88, square,
+                                          moves);
+    break;
+  case PieceType::Queen:
+    fill_possible_repeating_moves<kKinds>(board, kOrthogonalX88, square,
+                                          moves);
+    fill_possible_repeating_moves<kKinds>(board, kDiagonalX88, square, moves);
+    break;
+  default:
+    break;
+  }
+}
 
-        // Knights
-        else if (piece.type == PieceType::Knight) {
-          fill_possible_nonrepeating_moves(board, common::kKnightSteps, coord,
-                                           moves);
-        }
+template <MoveKinds kKinds, typename Moves>
+void fill_possible_moves(const Board &board, Moves &moves) {
+  // Iterate over all pieces of colors the player controls
+  const ColorMask colors = board.controlled_colors(board.player_to_move());
+  for (Square square : board.pieces(colors))
+    fill_possible_square_moves<kKinds>(board, square, colors, moves);
+}
 
-        // Bishops
-        else if (piece.type == PieceType::Bishop) {
-          fill_possible_repeating_moves(board, common::kDiagonalSteps, coord,
-                                        moves);
-        }
+std::vector<Move> get_possible_moves(const Board &board) {
+  PROFILE_SCOPE("get_possible_moves");
+  std::vector<Move> moves;
+  fill_possible_moves<kAllMoves>(board, moves);
+  return moves;
+}
 
-        // Rook
-        else if (piece.type == PieceType::Rook) {
-          fill_possible_repeating_moves(board, common::kOrthogonalSteps, coord,
-                                        moves);
-        }
+void get_possible_moves(const Board &board, MoveList &moves) {
+  PROFILE_SCOPE("get_possible_moves");
+  fill_possible_moves<kAllMoves>(board, moves);
+}
 
-        // Queen
-        else if (piece.type == PieceType::Queen) {
-          fill_possible_repeating_moves(board, common::kOrthogonalSteps, coord,
-                                        moves);
-          fill_possible_repeating_moves(board, common::kDiagonalSteps, coord,
-                                        moves);
-        }
-      }
-    }
+void get_possible_moves(const Board &board, MoveList &moves,
+                        MoveKinds kinds) {
+  PROFILE_SCOPE("get_possible_moves");
+  switch (kinds) {
+  case kCaptures:
+    fill_possible_moves<kCaptures>(board, moves);
+    break;
+  case kQuiets:
+    fill_possible_moves<kQuiets>(board, moves);
+    break;
+  case kAllMoves:
+    fill_possible_moves<kAllMoves>(board, moves);
+    break;
   }
-  return moves;
+}
+
+bool is_possible_move(const Board &board, const Move &move) {
+  const PackedPiece piece = board.packed_at(to_square(move.src));
+  const ColorMask colors = board.controlled_colors(board.player_to_move());
+  if (!(colors >> static_cast<int>(color_of(piece)) & 1))
+    return false;
+  common::ArenaScope scope;
+  MoveList moves = make_move_list();
+  fill_possible_square_moves<kAllMoves>(board, to_square(move.src), colors,
+                                        moves);
+  return std::find(moves.begin(), moves.end(), move) != moves.end();
 }
 
 bool move_kills_king(const Board &board, const Move &move) {
-  return board.piece_at(move.dest).type == PT::King;
+  return !move.is_defection() &&
+         type_of(board.packed_at(to_square(move.dest))) == PT::King;
 }
 
 bool is_in_check(const Board &board) {
+  PROFILE_SCOPE("is_in_check");
   Board next_board = board;
   next_board.player_to_move() = other_player(next_board.player_to_move());
-  auto responses = get_possible_moves(next_board);
+  common::ArenaScope scope;
+  MoveList responses = make_move_list();
+  get_possible_moves(next_board, responses);
   for (const Move &response : responses) {
     if (move_kills_king(next_board, response))
       return true;
@@ -344,12 +693,24 @@ bool is_in_check(const Board &board) {
 }
 
 bool move_into_check(const Board &board, const Move &move) {
+  PROFILE_SCOPE("move_into_check");
+  // A king may not castle out of or through check
+  if (is_castle(board, move)) {
+    Coord crossed{move.src.rank, (move.src.file + move.dest.file) / 2};
+    if (is_in_check(board) || move_into_check(board, Move{move.src, crossed}))
+      return true;
+  }
+
   Board next_board = board;
   next_board.make_move(move);
   next_board.player_to_move() = other_player(next_board.player_to_move());
   return is_in_check(next_board);
 }
 
+bool is_legal_move(const Board &board, const Move &move) {
+  return !move_into_check(board, move);
+}
+
 std::vector<Move> Game::get_legal_moves(const Board &board) {
   std::vector<Move> moves = get_possible_moves(board);
   std::erase_if(moves,
@@ -357,4 +718,16 @@ std::vector<Move> Game::get_legal_moves(const Board &board) {
   return moves;
 }
 
-} // namespace sovereign_chess
\ No newline at end of file
+void Game::get_legal_moves(const Board &board, MoveList &moves) {
+  get_possible_moves(board, moves);
+  std::erase_if(moves,
+                [&](const Move &m) { return move_into_check(board, m); });
+}
+
+int Game::material_balance(const Board &board) {
+  const Player self = board.player_to_move();
+  return board.pieces(board.controlled_colors(self)).size() -
+         board.pieces(board.controlled_colors(other_player(self))).size();
+}
+
+} // namespace sovereign_chess
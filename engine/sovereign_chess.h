@@ -1,5 +1,10 @@
 #pragma once
+#include "arena.h"
 #include "chess.h"
+#include "game.h"
+#include "square_set.h"
+
+#include <type_traits>
 
 namespace sovereign_chess {
 using common::Coord;
@@ -12,6 +17,8 @@ inline Player other_player(Player player) {
   return player == Player::Player1 ? Player::Player2 : Player::Player1;
 };
 
+enum class Castle { Kingside, Queenside };
+
 enum class Color : uint8_t {
   Empty,
   White,
@@ -29,7 +36,7 @@ enum class Color : uint8_t {
 };
 
 // clang-format off
-const std::unordered_map<Coord, Color, common::coord_hash> colored_squares = {
+constexpr std::array<std::pair<Coord, Color>, 24> kColoredSquares = {{
   {{4, 4}, Color::Navy},
   {{11, 11}, Color::Navy},
   {{11, 4}, Color::Red},
@@ -54,8 +61,11 @@ const std::unordered_map<Coord, Color, common::coord_hash> colored_squares = {
   {{7, 8}, Color::White},
   {{10, 7}, Color::Pink},
   {{5, 8}, Color::Pink}
-};
+}};
 // clang-format on
+const std::unordered_map<Coord, Color, common::coord_hash> colored_squares(
+    kColoredSquares.begin(), kColoredSquares.end());
+
 inline std::optional<Color> square_color(Coord coord) {
   auto it = colored_squares.find(coord);
   if (it != colored_squares.end())
@@ -88,6 +98,99 @@ struct Piece {
   bool operator!=(const Piece &other) const { return !(*this == other); }
 };
 
+// ----------------------------- Packed encodings ---------------------------
+
+constexpr Square to_square(const Coord &coord) {
+  return coord.rank * 16 + coord.file;
+}
+constexpr Coord to_coord(Square square) {
+  return Coord{square >> 4, square & 15};
+}
+
+/** Stepping across the board happens in a 0x88-style index, rank * 32 + file,
+ * where the unused bit 4 and anything outside bits 0-8 flag an off-board
+ * square for steps of up to 16 ranks or files.
+ */
+constexpr int to_x88(Square square) { return square + (square & 0xf0); }
+constexpr Square from_x88(int x88) { return (x88 & 0xf) | ((x88 >> 1) & 0xf0); }
+constexpr bool off_board(int x88) { return x88 & ~0x1ef; }
+constexpr int x88_step(const Coord &step) {
+  return step.rank * 32 + step.file;
+}
+
+// One of the 12 colors and a type from pawn to king
+constexpr bool is_valid_piece(const Piece &piece) {
+  return piece.color >= Color::White && piece.color <= Color::Violet &&
+         piece.type >= PieceType::Pawn && piece.type <= PieceType::King;
+}
+
+// Color in bits 0-3 and type in bits 4-6; an empty square is 0
+using PackedPiece = uint8_t;
+constexpr PackedPiece kNoPiece = 0;
+constexpr PackedPiece pack_piece(const Piece &piece) {
+  return static_cast<uint8_t>(piece.color) |
+         static_cast<uint8_t>(piece.type) << 4;
+}
+constexpr Color color_of(PackedPiece piece) {
+  return static_cast<Color>(piece & 0xf);
+}
+constexpr PieceType type_of(PackedPiece piece) {
+  return static_cast<PieceType>(piece >> 4);
+}
+constexpr Piece unpack_piece(PackedPiece piece) {
+  return Piece{type_of(piece), color_of(piece)};
+}
+
+// Color of each square, Color::Empty if uncolored
+constexpr auto kSquareColors = [] {
+  std::array<Color, 256> colors{};
+  for (const auto &[coord, color] : kColoredSquares)
+    colors[to_square(coord)] = color;
+  return colors;
+}();
+
+// The two squares of each color, indexed by Color
+constexpr auto kColorSquares = [] {
+  std::array<std::array<Square, 2>, 13> squares{};
+  std::array<int, 13> found{};
+  for (const auto &[coord, color] : kColoredSquares) {
+    int c = static_cast<int>(color);
+    squares[c][found[c]++] = to_square(coord);
+  }
+  return squares;
+}();
+
+// For a colored square, the other square of the same color
+constexpr auto kOtherSquareOfSameColor = [] {
+  std::array<Square, 256> other{};
+  for (const auto &pair : kColorSquares) {
+    other[pair[0]] = pair[1];
+    other[pair[1]] = pair[0];
+  }
+  return other;
+}();
+
+/** Zobrist-style hashing: each feature of a position has a pseudo-random
+ * key, and a position's hash is the xor of the keys of its features. Keys are
+ * computed on demand by mixing the feature's index, numbered as below.
+ */
+constexpr uint64_t hash_key(uint64_t index) {
+  uint64_t z = (index + 1) * 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return z ^ (z >> 31);
+}
+constexpr uint64_t piece_key(Square square, PackedPiece piece) {
+  return hash_key(square << 8 | piece);
+}
+constexpr uint64_t kPlayer2ToMoveKey = hash_key(1 << 16);
+constexpr uint64_t owned_color_key(int player, Color color) {
+  return hash_key((1 << 16) + 1 + player * 16 + static_cast<int>(color));
+}
+constexpr uint64_t castle_right_key(int index) {
+  return hash_key((1 << 16) + 33 + index);
+}
+
 inline std::string to_algebraic(const Coord &c) {
   char file = 'a' + c.file;
   char rank = c.rank < 9 ? '1' + c.rank : 'A' + (c.rank - 9);
@@ -98,70 +201,189 @@ inline Coord from_algebraic(std::string_view s) {
   return Coord{s[1] < 58 ? s[1] - 49 : s[1] - 65 + 9, s[0] - 97};
 }
 
+/** A move from src to dest. Castling is written as the king moving two files
+ * toward the rook. Defection, where a player swaps their king for one of
+ * another color they control, keeps the king in place (src == dest) and
+ * gives the new color; in strings it follows the squares, e.g. "i1i1r".
+ */
 struct Move {
   Coord src;
   Coord dest;
   PieceType promotion_type = PieceType::Invalid;
+  Color defect_color = Color::Empty;
 
   Move(Coord n_src, Coord n_dest) : src(n_src), dest(n_dest) {}
 
   Move(std::string_view move_str)
-      : Move(move_str.substr(0, 2), move_str.substr(2, 4)) {
-    promotion_type = common::name_to_piece_type(move_str[4]);
+      : Move(move_str.substr(0, 2), move_str.substr(2, 2)) {
+    if (move_str.size() > 4) {
+      if (src == dest)
+        defect_color = name_to_color(move_str[4]);
+      else
+        promotion_type = common::name_to_piece_type(move_str[4]);
+    }
   }
 
   Move(std::string_view n_src, std::string_view n_dest)
       : src(from_algebraic(n_src)), dest(from_algebraic(n_dest)) {}
 
+  static Move defection(Coord king, Color color) {
+    Move move{king, king};
+    move.defect_color = color;
+    return move;
+  }
+  bool is_defection() const { return defect_color != Color::Empty; }
+
   bool operator==(const Move &other) const {
     return src == other.src && dest == other.dest &&
-           promotion_type == other.promotion_type;
+           promotion_type == other.promotion_type &&
+           defect_color == other.defect_color;
   }
   std::string to_string() const {
     std::ostringstream ss;
     ss << to_algebraic(src) << to_algebraic(dest);
     if (promotion_type != PieceType::Invalid)
       ss << common::piece_names.at(promotion_type);
+    if (is_defection())
+      ss << color_names.at(defect_color);
     return ss.str();
   }
 };
 
 inline std::ostream &operator<<(std::ostream &out, const Move &m) {
   out << "Move{" << m.src << "," << m.dest << "," << (int)m.promotion_type
-      << "}";
+      << "," << (int)m.defect_color << "}";
   return out;
 }
 
+/** 32-bit move encoding for bulk output. Bits 0-7 hold the source square and
+ * bits 8-15 the destination, as rank * 16 + file; bits 16-19 hold the
+ * promotion type and bits 20-23 the color of a defection.
+ */
+using PackedMove = uint32_t;
+inline PackedMove pack_move(const Move &move) {
+  return (move.src.rank * 16 + move.src.file) |
+         (move.dest.rank * 16 + move.dest.file) << 8 |
+         static_cast<uint32_t>(move.promotion_type) << 16 |
+         static_cast<uint32_t>(move.defect_color) << 20;
+}
+inline Move unpack_move(PackedMove packed) {
+  Move move{Coord{static_cast<int>(packed >> 4 & 0xf),
+                  static_cast<int>(packed & 0xf)},
+            Coord{static_cast<int>(packed >> 12 & 0xf),
+                  static_cast<int>(packed >> 8 & 0xf)}};
+  move.promotion_type = static_cast<PieceType>(packed >> 16 & 0xf);
+  move.defect_color = static_cast<Color>(packed >> 20 & 0xf);
+  return move;
+}
+
+/** FEN format: six space-separated fields, of which only the first is
+ * required.
+ * - piece placement, rank 16 first, each piece as <color><type>
+ * - owned color of the player to move ("w")
+ * - owned colors of Player 1 and Player 2 ("wb")
+ * - castle rights, KQ for Player 1 and kq for Player 2, or "-"
+ * - halfmove clock since the last capture or pawn move
+ * - fullmove number, incremented after Player 2 moves
+ * Missing fields take the values of the initial position, except castle
+ * rights which are derived from the king and rook origin squares.
+ */
 class Board {
 public:
   Board();
 
   void make_move(const Move &move);
+  // Piece{} empties the square. Invalid pieces are ignored.
   void place_piece(const Piece &piece, const Coord &coord);
 
   static Board from_fen(std::string_view fen);
-  std::string to_fen();
+  std::string to_fen() const;
+
+  bool operator==(const Board &other) const = default;
 
   Player player_to_move() const { return player_to_move_; };
   Player &player_to_move() { return player_to_move_; };
 
-  const Piece &piece_at(const Coord &coord) const {
-    return pieces_[coord.rank][coord.file];
+  Piece piece_at(const Coord &coord) const {
+    return unpack_piece(squares_[to_square(coord)]);
+  }
+  PackedPiece packed_at(Square square) const { return squares_[square]; }
+  SquareSet squares_with_colors(ColorMask colors) const {
+    return sovereign_chess::squares_with_colors(squares_.data(), colors);
+  }
+  // Squares of the pieces of one color, kept up to date as pieces move
+  const SquareSet &pieces(Color color) const {
+    return pieces_[static_cast<int>(color) - 1];
+  }
+  // Squares of the pieces of any of the colors
+  SquareSet pieces(ColorMask colors) const;
+  Color owned_color(Player player) const {
+    return owned_color_[static_cast<int>(player)];
+  }
+  Color &owned_color(Player player) {
+    return owned_color_[static_cast<int>(player)];
+  }
+
+  bool castle_right(Player player, Castle side) const {
+    return castle_rights_[static_cast<int>(player) * 2 +
+                          static_cast<int>(side)];
   }
-  Piece &piece_at(const Coord &coord) {
-    return pieces_[coord.rank][coord.file];
+  bool &castle_right(Player player, Castle side) {
+    return castle_rights_[static_cast<int>(player) * 2 +
+                          static_cast<int>(side)];
   }
-  Color owned_color(Player player) const { return owned_color_.at(player); }
+
+  int halfmove_clock() const { return halfmove_clock_; }
+  int &halfmove_clock() { return halfmove_clock_; }
+  int fullmove_number() const { return fullmove_number_; }
+  int &fullmove_number() { return fullmove_number_; }
+
+  // Hash of everything but the move counters, for repetition detection
+  uint64_t hash() const;
 
   // Which player controls a color, or empty if it's neutral
   std::optional<Player> controlling_player(Color color) const;
+  // All colors the player controls
+  ColorMask controlled_colors(Player player) const;
 
 private:
-  std::array<std::array<Piece, 16>, 16> pieces_;
+  // Writes a square and keeps the piece sets in sync
+  void set_square(Square square, PackedPiece piece);
+
+  std::array<PackedPiece, 256> squares_;
+  std::array<SquareSet, 12> pieces_; // By color, without Color::Empty
+  uint64_t pieces_hash_ = 0;         // Kept up to date by set_square
   Player player_to_move_ = Player::Player1;
-  std::unordered_map<Player, Color> owned_color_ = {
-      {Player::Player1, Color::White}, {Player::Player2, Color::Black}};
+  std::array<Color, 2> owned_color_ = {Color::White, Color::Black};
+  std::array<bool, 4> castle_rights_ = {true, true, true, true};
+  int halfmove_clock_ = 0;
+  int fullmove_number_ = 1;
 };
+// Search copies boards at every node, so copies must stay a plain memcpy
+static_assert(std::is_trivially_copyable_v<Board>);
+
+inline const std::string kInitialFen =
+    "aqabvrvnbrbnbbbqbkbbbnbrynyrsbsq/aranvpvpbpbpbpbpbpbpbpbpypypsnsr/"
+    "nbnp12opob/nqnp12opoq/crcp12rprr/cncp12rprn/gbgp12pppb/gqgp12pppq/"
+    "yqyp12vpvq/ybyp12vpvb/onop12npnn/orop12npnr/rqrp12cpcq/rbrp12cpcb/"
+    "srsnppppwpwpwpwpwpwpwpwpgpgpanar/sqsbprpnwrwnwbwqwkwbwnwrgngrabaq "
+    "w wb KQkq 0 1";
+
+/** from_fen trusts its input. For FENs from outside, checks that the
+ * placement has 16 ranks of 16 files of known pieces, that the players own
+ * different colors and one of them is active, and that any castle rights and
+ * move counters that follow are well formed, with nothing after them.
+ */
+bool is_valid_fen(std::string_view fen);
+
+// Origin squares of each player's king and castling rooks
+inline Coord king_origin(Player player) {
+  return Coord{player == Player::Player1 ? 0 : 15, 8};
+}
+inline Coord rook_origin(Player player, Castle side) {
+  return Coord{player == Player::Player1 ? 0 : 15,
+               side == Castle::Kingside ? 11 : 4};
+}
 
 inline bool is_enemy_color(const Board &board, Color color) {
   return board.controlling_player(color) ==
@@ -174,11 +396,44 @@ inline bool is_friendly_color(const Board &board, Color color) {
 
 bool is_in_check(const Board &board);
 
+// Move list backed by the calling thread's arena, for search and perft.
+// Create it inside a common::ArenaScope, which releases the memory on exit.
+using MoveList = std::vector<Move, common::ArenaAllocator<Move>>;
+inline MoveList make_move_list() {
+  MoveList moves;
+  moves.reserve(256);
+  return moves;
+}
+
 std::vector<Move> get_possible_moves(const Board &board);
+void get_possible_moves(const Board &board, MoveList &moves);
 
+// Kinds of possible moves: captures land on an enemy piece, and quiet moves
+// (including castling and defection) don't
+enum MoveKinds { kCaptures = 1, kQuiets = 2, kAllMoves = kCaptures | kQuiets };
+// Possible moves of the given kinds, in get_possible_moves order
+void get_possible_moves(const Board &board, MoveList &moves, MoveKinds kinds);
+// Whether the move is possible, e.g. one remembered from another position
+bool is_possible_move(const Board &board, const Move &move);
+// Whether a possible move keeps the mover's kings out of check
+bool is_legal_move(const Board &board, const Move &move);
+
+class PositionHistory; // position_history.h
+
+// Adapter for common::Game
 struct Game {
   using Board = sovereign_chess::Board;
+  using Move = sovereign_chess::Move;
+  using MoveList = sovereign_chess::MoveList;
+  using History = PositionHistory;
   static std::vector<Move> get_legal_moves(const Board &board);
+  // Fills moves, which should be empty
+  static void get_legal_moves(const Board &board, MoveList &moves);
+  static bool is_in_check(const Board &board) {
+    return sovereign_chess::is_in_check(board);
+  }
+  // Pieces of colors the player to move controls less the opponent's
+  static int material_balance(const Board &board);
 };
 
 } // namespace sovereign_chess
\ No newline at end of file
@@ -1,6 +1,19 @@
 
+#include "batch.h"
+#include "binary_position.h"
+#include "generic_bots.h"
+#include "lru_cache.h"
+#include "opening_book.h"
+#include "move_picker.h"
+#include "perft.h"
+#include "position_history.h"
+#include "reference_movegen.h"
+#include "search.h"
+#include "tablebase.h"
 #include "sovereign_chess.h"
 #include <algorithm>
+#include <fstream>
+#include <map>
 #include <sstream>
 
 #include <cassert>
@@ -21,6 +34,10 @@ void print_board_colors() {
   std::cout << out.str();
 }
 
+// The initial piece placement, without the other fields
+const std::string kInitialPlacement =
+    kInitialFen.substr(0, kInitialFen.find(' '));
+
 void test_coords() {
   assert(to_algebraic({0, 0}) == "a1");
   assert(to_algebraic({8, 7}) == "h9");
@@ -28,12 +45,944 @@ void test_coords() {
   assert(to_algebraic({15, 15}) == "pG");
 }
 
+void test_packed_board() {
+  // Squares, per-color piece sets and a few bytes of state
+  static_assert(sizeof(Board) <= 256 + 12 * sizeof(SquareSet) + 24);
+  for (int square = 0; square < 256; square++) {
+    Coord coord = to_coord(square);
+    assert(to_square(coord) == square);
+    assert(from_x88(to_x88(square)) == square);
+    assert(kSquareColors[square] ==
+           square_color(coord).value_or(Color::Empty));
+    for (const Coord &step : common::kKnightSteps) {
+      Coord dest = coord + step;
+      bool on_board = dest.rank >= 0 && dest.rank < 16 && dest.file >= 0 &&
+                      dest.file < 16;
+      int x88 = to_x88(square) + x88_step(step);
+      assert(off_board(x88) == !on_board);
+      assert(!on_board || from_x88(x88) == to_square(dest));
+    }
+  }
+  assert(kOtherSquareOfSameColor[to_square({4, 4})] == to_square({11, 11}));
+
+  Piece piece{PieceType::Queen, Color::Violet};
+  assert(unpack_piece(pack_piece(piece)) == piece);
+  assert(unpack_piece(kNoPiece) == Piece{});
+}
+
+void test_square_set() {
+  common::Rng rng(7);
+  alignas(32) std::array<uint8_t, 256> squares;
+  for (int trial = 0; trial < 100; trial++) {
+    for (auto &square : squares)
+      square = rng.below(256);
+    auto colors = static_cast<ColorMask>(rng() & 0xfffe);
+    SquareSet expected;
+    for (int square = 0; square < 256; square++) {
+      if (colors >> (squares[square] & 0xf) & 1)
+        expected.insert(square);
+    }
+    assert(squares_with_colors_scalar(squares.data(), colors) == expected);
+    assert(squares_with_colors(squares.data(), colors) == expected);
+
+    int count = 0, last = -1;
+    for (Square square : expected) {
+      assert(square > last && expected.contains(square));
+      last = square;
+      count++;
+    }
+    assert(count == expected.size());
+  }
+
+  auto b = Board::from_fen(kInitialFen);
+  ColorMask white = 1 << static_cast<int>(Color::White);
+  assert(b.squares_with_colors(white).size() == 16);
+  assert(b.controlled_colors(Player::Player1) == white);
+}
+
+void test_piece_sets() {
+  auto b = Board::from_fen(kInitialFen);
+  common::Rng rng(3);
+  for (int ply = 0; ply < 300; ply++) {
+    for (int color = 1; color < 13; color++) {
+      auto c = static_cast<Color>(color);
+      assert(b.pieces(c) == b.squares_with_colors(1 << color));
+    }
+    ColorMask own = b.controlled_colors(b.player_to_move());
+    assert(b.pieces(own) == b.squares_with_colors(own));
+
+    auto moves = Game::get_legal_moves(b);
+    if (moves.empty())
+      break;
+    b.make_move(moves[rng.below(moves.size())]);
+  }
+
+  // Overwriting a square moves it between sets
+  b = Board::from_fen(kInitialFen);
+  b.place_piece(Piece{PieceType::Queen, Color::Red}, {0, 8});
+  assert(!b.pieces(Color::White).contains(to_square({0, 8})));
+  assert(b.pieces(Color::Red).contains(to_square({0, 8})));
+  b.place_piece(Piece{}, {0, 8});
+  assert(!b.pieces(Color::Red).contains(to_square({0, 8})));
+}
+
+void test_fen() {
+  { // Missing fields take initial values
+    auto b = Board::from_fen(kInitialPlacement + " w");
+    assert(b.player_to_move() == Player::Player1);
+    assert(b.owned_color(Player::Player1) == Color::White);
+    assert(b.owned_color(Player::Player2) == Color::Black);
+    assert(b.castle_right(Player::Player1, Castle::Kingside));
+    assert(b.castle_right(Player::Player2, Castle::Queenside));
+    assert(b.halfmove_clock() == 0);
+    assert(b.fullmove_number() == 1);
+    assert(b.to_fen() == kInitialPlacement + " w wb KQkq 0 1");
+  }
+
+  // Full FENs round-trip
+  for (const char *fields :
+       {" w wb KQkq 0 1", " b wb Kq 3 12", " r rb - 0 40", " w rw Qk 7 9"}) {
+    auto b = Board::from_fen(kInitialPlacement + fields);
+    assert(b.to_fen() == kInitialPlacement + fields);
+  }
+
+  { // Side to move is whichever player owns the active color
+    auto b = Board::from_fen(kInitialPlacement + " r br - 0 1");
+    assert(b.player_to_move() == Player::Player2);
+    assert(b.owned_color(Player::Player1) == Color::Black);
+    assert(b.owned_color(Player::Player2) == Color::Red);
+  }
+
+  { // Castle rights derived from origin squares when absent
+    auto b = Board::from_fen(
+        "aqabvrvnbrbnbbbqbkbbbnbrynyrsbsq/aranvpvpbpbpbpbpbpbpbpbpypypsnsr/"
+        "nbnp12opob/nqnp12opoq/crcp12rprr/cncp12rprn/gbgp12pppb/gqgp12pppq/"
+        "yqyp12vpvq/ybyp12vpvb/onop12npnn/orop12npnr/rqrp12cpcq/rbrp12cpcb/"
+        "srsnppppwpwpwpwpwpwpwpwpgpgpanar/sqsbprpnwrwnwbwqwkwbwn1gngrabaq w");
+    assert(!b.castle_right(Player::Player1, Castle::Kingside));
+    assert(b.castle_right(Player::Player1, Castle::Queenside));
+  }
+
+  { // Unknown colors and types, and squares past the edge, are skipped
+    auto b = Board::from_fen("zpwxwp14bp w");
+    assert(b.piece_at(from_algebraic("aG")).color == Color::Empty);
+    assert(b.piece_at(from_algebraic("bG")).color == Color::Empty);
+    assert((b.piece_at(from_algebraic("cG")) ==
+            Piece{PieceType::Pawn, Color::White}));
+    assert(b.pieces(1 << static_cast<int>(Color::Black)).empty());
+  }
+
+  // Only well-formed FENs are valid
+  assert(is_valid_fen(kInitialPlacement + " w wb KQkq 0 1"));
+  assert(is_valid_fen(kInitialPlacement + " w wb"));
+  assert(!is_valid_fen(kInitialPlacement + " w"));
+  assert(!is_valid_fen("garbage"));
+  assert(!is_valid_fen("zpwxwp14bp w wb"));
+  assert(!is_valid_fen(kInitialFen + " wb KQkq 0 1")); // extra fields
+  assert(!is_valid_fen(kInitialPlacement + " w wb XYZ abc"));
+  assert(!is_valid_fen(kInitialPlacement + " w wb KK 0 1"));
+  assert(!is_valid_fen(kInitialPlacement + " w wb KQkq 0 x"));
+  assert(!is_valid_fen(kInitialPlacement + " w wb - -1 1"));
+  assert(!is_valid_fen(kInitialPlacement + " w ww"));
+  assert(!is_valid_fen(kInitialPlacement + " r wb"));
+  assert(is_valid_fen(kInitialPlacement + " b wb - 3"));
+  assert(is_valid_fen(kInitialPlacement + " r br Kq 17 300"));
+  assert(!is_valid_fen(
+      kInitialPlacement.substr(kInitialPlacement.find('/') + 1) + " w wb"));
+
+  { // make_move updates counters and castle rights
+    auto b = Board::from_fen("4br3bk2br4/16/16/16/16/16/16/16/16/16/16/16/16/"
+                             "16/wp15/4wr3wk2wr4 w wb KQkq 0 1");
+    b.make_move({"l1", "l5"}); // rook leaves origin
+    assert(b.to_fen().ends_with(" b wb Qkq 1 1"));
+    b.make_move({"iG", "iF"}); // king leaves origin
+    assert(b.to_fen().ends_with(" w wb Q 2 2"));
+    b.make_move({"a2", "a3"}); // pawn move resets clock
+    assert(b.to_fen().ends_with(" b wb Q 0 2"));
+    b.make_move({"eG", "e1"}); // capture on rook origin
+    assert(b.to_fen().ends_with(" w wb - 0 3"));
+    assert(Board::from_fen(b.to_fen()).to_fen() == b.to_fen());
+  }
+}
+
+void test_binary_position() {
+  const std::vector<std::string> fens = {
+      kInitialFen, kInitialPlacement + " r rb Kq 17 300",
+      "4br3bk2br4/16/16/16/16/16/16/16/16/16/16/16/16/16/wp15/4wr3wk2wr4 b wb "
+      "Qk 3 2",
+      "16/16/16/16/16/16/16/16/16/16/16/16/16/16/16/16 w wb - 0 1"};
+
+  { // Records round-trip and scale with the number of pieces
+    uint8_t record[kMaxPositionSize];
+    for (const auto &fen : fens) {
+      Board board = Board::from_fen(fen);
+      std::size_t size = encode_position(board, record);
+      assert(encoded_size(record, size) == size);
+
+      Board decoded = Board::from_fen(kInitialFen);
+      assert(decode_position(record, size, decoded) == size);
+      assert(decoded.to_fen() == fen);
+
+      // Truncated records are rejected
+      assert(decode_position(record, size - 1, decoded) == 0);
+    }
+
+    // So are corrupt ones, without changing the board: owned colors 15 and
+    // 0, pawns of colors 15 and 0, an invalid type and a type past king
+    const std::size_t size = encode_position(Board::from_fen(fens[2]), record);
+    const std::vector<std::pair<std::size_t, uint8_t>> corruptions = {
+        {1, 0x2f},
+        {1, 0x20},
+        {kPositionHeaderSize, 0x1f},
+        {kPositionHeaderSize, 0x10},
+        {kPositionHeaderSize, 0x01},
+        {kPositionHeaderSize, 0x71}};
+    Board decoded = Board::from_fen(fens[0]);
+    for (const auto &[offset, value] : corruptions) {
+      uint8_t corrupt[kMaxPositionSize];
+      std::copy(record, record + size, corrupt);
+      corrupt[offset] = value;
+      assert(decode_position(corrupt, size, decoded) == 0);
+    }
+    assert(decoded.to_fen() == fens[0]);
+    assert(encode_position(Board::from_fen(fens[0]), record) ==
+           kPositionHeaderSize + 112);
+  }
+
+  { // Stream through a file and read it back via a memory mapping
+    const std::string path = "/tmp/sovereign_chess_test_positions.bin";
+    {
+      std::ofstream out(path, std::ios::binary);
+      PositionWriter writer(out);
+      for (const auto &fen : fens)
+        writer.write(Board::from_fen(fen));
+      assert(writer.count() == fens.size());
+    }
+
+    MappedFile file(path);
+    assert(file.is_open());
+    PositionReader reader = file.positions();
+    assert(reader.valid());
+    Board board;
+    std::size_t count = 0;
+    while (reader.next(board)) {
+      assert(board.to_fen() == fens[count]);
+      count++;
+    }
+    assert(count == fens.size());
+    std::remove(path.c_str());
+
+    assert(!PositionReader(file.data(), 4).valid());
+  }
+}
+
+void test_batch() {
+  std::vector<std::string> fens = {
+      kInitialPlacement + " w",
+      kInitialPlacement + " b",
+      "aqabvrvnbrbnbbbqbkbbbnbrynyrsbsq/aranvpvpbpbpbpbpbpbp3ypsnsr/"
+      "nbnp5np1yp4opob/nq5wp3bp3opoq/crcp6wn2bp2rprr/cncp12rprn/gbgp12pppb/"
+      "gqgp12pppq/yqyp12vpvq/ybyp12vpvb/onop12npnn/orop12npnr/rqrp12cpcq/"
+      "rbrp12cpcb/srsnppppwpwpwpwpwp1wpwpgpgpanar/"
+      "sqsbprpnwrwnwbwqwkwb1wrgngrabaq w",
+      "16/16/16/16/16/16/16/16/16/16/16/16/16/16/16/16 w"};
+  // Enough positions that every worker gets some
+  const std::vector<std::string> distinct = fens;
+  for (int i = 0; i < 4; i++)
+    fens.insert(fens.end(), distinct.begin(), distinct.end());
+
+  std::vector<std::string_view> fen_views(fens.begin(), fens.end());
+  std::ostringstream records;
+  {
+    PositionWriter writer(records);
+    for (const auto &fen : fens)
+      writer.write(Board::from_fen(fen));
+  }
+  std::string file = records.str();
+  const uint8_t *data = reinterpret_cast<const uint8_t *>(file.data());
+
+  common::ThreadPool pool(3);
+  for (bool binary : {false, true}) {
+    std::vector<PackedMove> moves(fens.size() * kMaxMovesPerPosition);
+    std::vector<uint32_t> counts(fens.size());
+    if (binary)
+      get_legal_moves_batch(data + kPositionFileHeaderSize,
+                            file.size() - kPositionFileHeaderSize, fens.size(),
+                            {moves.data(), counts.data()}, pool);
+    else
+      get_legal_moves_batch(fen_views, {moves.data(), counts.data()}, pool);
+
+    for (std::size_t i = 0; i < fens.size(); i++) {
+      auto expected = Game::get_legal_moves(Board::from_fen(fens[i]));
+      assert(counts[i] == expected.size());
+      for (std::size_t j = 0; j < expected.size(); j++)
+        assert(unpack_move(moves[i * kMaxMovesPerPosition + j]) ==
+               expected[j]);
+    }
+    assert(counts.back() == 0);
+  }
+}
+
+void test_random_bot() {
+  { // Same seed, same game
+    auto b = Board::from_fen(kInitialFen);
+    RandomBot bot1(42), bot2(42);
+    for (int ply = 0; ply < 10; ply++) {
+      auto move = bot1.select_move(b);
+      assert(move && move == bot2.select_move(b));
+      b.make_move(*move);
+    }
+  }
+
+  { // Playouts are reproducible
+    auto b = Board::from_fen(kInitialFen);
+    common::Rng rng1(7), rng2(7);
+    for (int i = 0; i < 3; i++)
+      assert(random_playout(b, rng1, 30) == random_playout(b, rng2, 30));
+    assert(rng1() == rng2());
+  }
+
+  { // Checkmated side to move loses the playout immediately
+    auto b = Board::from_fen("16/16/16/16/16/16/16/16/16/16/16/16/16/16/"
+                             "7wr8/bk6wr8 b");
+    common::Rng rng(1);
+    assert(Game::get_legal_moves(b).empty());
+    assert(random_playout(b, rng, 10) == Player::Player1);
+  }
+}
+
+void test_mcts_bot() {
+  // Rh3-h1 mates
+  auto b = Board::from_fen("15wk/16/16/16/16/16/16/16/16/16/16/16/16/7wr8/"
+                           "6wr9/bk15 w");
+  for (auto parallelism :
+       {MctsOptions::Parallelism::Tree, MctsOptions::Parallelism::Root}) {
+    MctsOptions options;
+    options.playouts = 300;
+    options.threads = 2;
+    options.parallelism = parallelism;
+    options.rollout_plies = 10;
+    MctsBot bot(options);
+    auto move = bot.select_move(b);
+    assert(move == Move("h3", "h1"));
+    assert(bot.last_playouts() == 300);
+
+    // Search again after a different pair of moves; the tree is reused
+    Board next = b;
+    next.make_move({"g2", "f2"});
+    next.make_move({"a1", "b1"});
+    assert(bot.select_move(next));
+  }
+}
+
+void test_arena() {
+  common::Arena arena(1024);
+  {
+    common::ArenaScope scope(arena);
+    void *a = arena.allocate(100, 8);
+    void *b = arena.allocate(100, 8);
+    assert(a != b);
+    arena.allocate(4096, 16); // larger than a block
+  }
+  std::size_t capacity = arena.capacity();
+  { // Released memory is reused without growing
+    common::ArenaScope scope(arena);
+    std::vector<int, common::ArenaAllocator<int>> values(
+        common::ArenaAllocator<int>{arena});
+    for (int i = 0; i < 100; i++)
+      values.push_back(i);
+  }
+  assert(arena.capacity() == capacity);
+  arena.reset();
+  assert(arena.capacity() == capacity);
+}
+
+void test_lru_cache() {
+  common::LruCache<uint64_t, std::string> cache(2);
+  assert(!cache.find(1));
+  cache.insert(1, "a");
+  cache.insert(2, "b");
+  assert(*cache.find(1) == "a"); // 2 is now least recently used
+  cache.insert(3, "c");
+  assert(cache.size() == 2 && !cache.find(2) && *cache.find(3) == "c");
+  int computed = 0;
+  const auto compute = [&] {
+    computed++;
+    return std::string("d");
+  };
+  assert(cache.find_or_insert(4, compute) == "d");
+  assert(cache.find_or_insert(4, compute) == "d" && computed == 1);
+  assert(cache.hits() == 3 && cache.misses() == 3);
+  cache.clear();
+  assert(cache.size() == 0 && !cache.find(4));
+}
+
+void test_perft() {
+  auto b = Board::from_fen(kInitialFen);
+  auto legal_moves = Game::get_legal_moves(b);
+  assert(perft(b, 0) == 1);
+  assert(perft(b, 1) == legal_moves.size());
+
+  uint64_t nodes = 0;
+  for (const Move &move : legal_moves) {
+    Board next = b;
+    next.make_move(move);
+    nodes += Game::get_legal_moves(next).size();
+  }
+  assert(perft(b, 2) == nodes);
+}
+
 bool is_legal(const Board &board, const Move &move) {
   auto legal_moves = Game::get_legal_moves(board);
   return std::find(legal_moves.begin(), legal_moves.end(), move) !=
          legal_moves.end();
 }
 
+// FEN with the given ranks (by index) filled in and the rest empty
+std::string sparse_fen(const std::map<int, std::string> &ranks,
+                       const std::string &fields) {
+  std::string fen;
+  for (int rank = 15; rank >= 0; rank--) {
+    auto it = ranks.find(rank);
+    fen += it != ranks.end() ? it->second : "16";
+    fen += rank ? "/" : " ";
+  }
+  return fen + fields;
+}
+
+void test_castling() {
+  const std::map<int, std::string> castle_ranks = {{15, "4br3bk2br4"},
+                                                   {0, "4wr3wk2wr4"}};
+  {
+    auto b = Board::from_fen(sparse_fen(castle_ranks, "w wb KQkq 0 1"));
+    assert(is_legal(b, {"i1", "k1"}));
+    assert(is_legal(b, {"i1", "g1"}));
+
+    Board kingside = b;
+    kingside.make_move({"i1", "k1"});
+    assert((kingside.piece_at(from_algebraic("k1")) ==
+            Piece{PieceType::King, Color::White}));
+    assert((kingside.piece_at(from_algebraic("j1")) ==
+            Piece{PieceType::Rook, Color::White}));
+    assert(kingside.piece_at(from_algebraic("l1")).color == Color::Empty);
+    assert(!kingside.castle_right(Player::Player1, Castle::Queenside));
+    assert(is_legal(kingside, {"iG", "gG"}));
+
+    Board queenside = b;
+    queenside.make_move({"i1", "g1"});
+    assert((queenside.piece_at(from_algebraic("h1")) ==
+            Piece{PieceType::Rook, Color::White}));
+    assert(queenside.piece_at(from_algebraic("e1")).color == Color::Empty);
+  }
+  { // No rights
+    auto b = Board::from_fen(sparse_fen(castle_ranks, "w wb Qkq 0 1"));
+    assert(!is_legal(b, {"i1", "k1"}));
+    assert(is_legal(b, {"i1", "g1"}));
+  }
+  { // Blocked
+    auto ranks = castle_ranks;
+    ranks[0] = "4wr1wn1wk2wr4";
+    auto b = Board::from_fen(sparse_fen(ranks, "w wb KQkq 0 1"));
+    assert(is_legal(b, {"i1", "k1"}));
+    assert(!is_legal(b, {"i1", "g1"}));
+  }
+  { // Through check
+    auto ranks = castle_ranks;
+    ranks[7] = "9br6";
+    auto b = Board::from_fen(sparse_fen(ranks, "w wb KQkq 0 1"));
+    assert(!is_legal(b, {"i1", "k1"}));
+    assert(is_legal(b, {"i1", "g1"}));
+  }
+  { // Out of check
+    auto ranks = castle_ranks;
+    ranks[7] = "8br7";
+    auto b = Board::from_fen(sparse_fen(ranks, "w wb KQkq 0 1"));
+    assert(!is_legal(b, {"i1", "k1"}));
+    assert(!is_legal(b, {"i1", "g1"}));
+  }
+  { // With a rook of a controlled color; white holds a red square
+    auto ranks = castle_ranks;
+    ranks[0] = "4wr3wk2rr4";
+    ranks[11] = "4wn11";
+    auto b = Board::from_fen(sparse_fen(ranks, "w wb KQkq 0 1"));
+    assert(is_legal(b, {"i1", "k1"}));
+    b.make_move({"i1", "k1"});
+    assert((b.piece_at(from_algebraic("j1")) ==
+            Piece{PieceType::Rook, Color::Red}));
+  }
+}
+
+void test_defection() {
+  // White controls red through the knight on a red square
+  auto b = Board::from_fen(
+      sparse_fen({{15, "8bk7"}, {11, "4wn11"}, {0, "8wk7"}}, "w wb - 0 1"));
+  const Move defect = Move::defection(from_algebraic("i1"), Color::Red);
+  assert(Move("i1i1r") == defect);
+  assert(Move("i1i1r").to_string() == "i1i1r");
+  assert(unpack_move(pack_move(defect)) == defect);
+  assert(is_legal(b, defect));
+  assert(!is_legal(b, Move::defection(from_algebraic("i1"), Color::Navy)));
+
+  b.make_move(defect);
+  assert(b.owned_color(Player::Player1) == Color::Red);
+  assert((b.piece_at(from_algebraic("i1")) ==
+          Piece{PieceType::King, Color::Red}));
+  // White is no longer held by anyone, so the knight is neutral
+  assert(!b.controlling_player(Color::White));
+  assert(b.to_fen().ends_with(" b rb - 1 1"));
+  assert(Board::from_fen(b.to_fen()) == b);
+  // Black's move back can't defect; black controls nothing else
+  for (const Move &move : Game::get_legal_moves(b))
+    assert(!move.is_defection());
+
+  // Red and navy each sit on the other's square, so neither is controlled
+  auto cycle = Board::from_fen(sparse_fen(
+      {{15, "8bk7"}, {11, "4nn11"}, {4, "4rn11"}, {0, "8wk7"}}, "w wb - 0 1"));
+  assert(!cycle.controlling_player(Color::Red));
+  assert(!cycle.controlling_player(Color::Navy));
+  assert(Game::get_legal_moves(cycle).size() == 5);
+}
+
+void test_position_history() {
+  { // The incremental hash matches a freshly built board
+    auto b = Board::from_fen(kInitialFen);
+    common::Rng rng(5);
+    for (int ply = 0; ply < 200; ply++) {
+      assert(b.hash() == Board::from_fen(b.to_fen()).hash());
+      Board flipped = b;
+      flipped.player_to_move() = other_player(b.player_to_move());
+      assert(flipped.hash() != b.hash());
+
+      auto moves = Game::get_legal_moves(b);
+      if (moves.empty())
+        break;
+      b.make_move(moves[rng.below(moves.size())]);
+    }
+  }
+
+  // Knights shuffle back and forth
+  auto b = Board::from_fen(
+      sparse_fen({{15, "1bn6bk7"}, {0, "1wn6wk7"}}, "w wb - 0 1"));
+  PositionHistory history;
+  history.push(b);
+  const std::vector<Move> cycle = {
+      {"b1", "c3"}, {"bG", "cE"}, {"c3", "b1"}, {"cE", "bG"}};
+  for (int round = 0; round < 2; round++) {
+    for (const Move &move : cycle) {
+      assert(!history.is_threefold());
+      b.make_move(move);
+      history.push(b);
+    }
+    assert(history.repetitions() == round + 1);
+  }
+  assert(history.is_threefold());
+
+  // Only plies since the last capture or pawn move count
+  history.clear();
+  b.halfmove_clock() = 0;
+  history.push(b);
+  assert(history.repetitions() == 0);
+
+  // Playouts leave the history as they found it
+  common::Rng rng(1);
+  random_playout(b, rng, 20, history);
+  assert(history.size() == 1);
+}
+
+void test_opening_book() {
+  auto start = Board::from_fen(kInitialFen);
+  const Move first = Game::get_legal_moves(start)[0];
+  Board after = start;
+  after.make_move(first);
+  const auto replies = Game::get_legal_moves(after);
+  const Move reply = replies[0];
+
+  std::ostringstream out;
+  write_book(out, {{after.hash(), pack_move(reply), 300},
+                   {start.hash(), pack_move(first), 500},
+                   {after.hash(), pack_move(replies[1]), 200}});
+  const std::string file = out.str();
+  assert(file.size() == kBookFileHeaderSize + 2 * kBookEntrySize);
+
+  OpeningBook book(reinterpret_cast<const uint8_t *>(file.data()),
+                   file.size());
+  assert(book.valid());
+  assert(book.size() == 2);
+  assert(book.lookup(start) == first);
+  assert(book.lookup(after) == reply); // the first entry wins
+  assert(book.find(after)->score == 300);
+
+  Board other = after;
+  other.make_move(reply);
+  assert(!book.lookup(other));
+
+  // A book move for the other player is ignored
+  Board flipped = after;
+  flipped.player_to_move() = other_player(after.player_to_move());
+  std::ostringstream wrong;
+  write_book(wrong, {{flipped.hash(), pack_move(reply), 1000}});
+  const std::string wrong_file = wrong.str();
+  OpeningBook wrong_book(
+      reinterpret_cast<const uint8_t *>(wrong_file.data()), wrong_file.size());
+  assert(wrong_book.find(flipped) && !wrong_book.lookup(flipped));
+
+  // So is one the player's own piece can't make
+  const Move impossible{first.src, Coord{7, 7}};
+  std::ostringstream illegal;
+  write_book(illegal, {{start.hash(), pack_move(impossible), 1000}});
+  const std::string illegal_file = illegal.str();
+  OpeningBook illegal_book(
+      reinterpret_cast<const uint8_t *>(illegal_file.data()),
+      illegal_file.size());
+  assert(illegal_book.find(start) && !illegal_book.lookup(start));
+
+  std::string corrupt = file;
+  corrupt[5] = kBookFileVersion + 1;
+  assert(!OpeningBook(reinterpret_cast<const uint8_t *>(corrupt.data()),
+                      corrupt.size())
+              .valid());
+}
+
+void test_tablebase() {
+  assert(Material::from_name("wkbkwq")->name() == "wkbkwq");
+  assert(Material::from_name("ykwkyn")->name() == "ykwkyn");
+  assert(!Material::from_name("wkbkwp"));   // pawns
+  assert(!Material::from_name("wkwkwq"));   // one owner
+  assert(!Material::from_name("wkbkyq"));   // neutral piece
+  assert(!Material::from_name("wkbkwqwr")); // too large
+
+  // Kings alone are drawn, and kings next to each other can't happen
+  const Material kings = *Material::from_name("wkbk");
+  auto codes = generate_tablebase(kings, Tablebases{});
+  assert(codes.size() == tablebase_size(kings));
+  Tablebases tables;
+  tables.add(kings, codes);
+  auto b =
+      Board::from_fen(sparse_fen({{7, "7wk8"}, {0, "bk15"}}, "b wb - 0 1"));
+  assert(Material::from_board(b) == kings);
+  auto result = tables.probe(b);
+  assert(result && result->outcome == 0);
+  auto rotated = Board::from_fen(
+      sparse_fen({{15, "15bk"}, {8, "8wk7"}}, "b wb - 0 1"));
+  assert(tablebase_index(rotated) == tablebase_index(b));
+  assert(!tables.probe(
+      Board::from_fen(sparse_fen({{1, "1wk14"}, {0, "bk15"}}, "b wb - 0 1"))));
+  assert(!tables.probe(
+      Board::from_fen(sparse_fen({{7, "7wk8"}, {0, "bk15"}}, "b wb K 0 1"))));
+  assert(!tables.probe(Board::from_fen(
+      sparse_fen({{7, "7wk8"}, {1, "5wp10"}, {0, "bk15"}}, "b wb - 0 1"))));
+
+  { // Through a file
+    const std::string path = "/tmp/sovereign_chess_test_wkbk.sctb";
+    assert(write_tablebase(path, kings, codes));
+    Tablebases loaded;
+    assert(loaded.load(path) && loaded.contains(kings));
+    assert(loaded.probe(b)->outcome == 0);
+    codes.pop_back();
+    assert(write_tablebase(path, kings, codes));
+    assert(!Tablebases().load(path));
+    std::remove(path.c_str());
+  }
+
+  // The minimax bot plays into a position the table says is mated
+  const Material queen = *Material::from_name("wkbkwq");
+  b = Board::from_fen(sparse_fen(
+      {{15, "15bk"}, {5, "7wq8"}, {0, "wk15"}}, "w wb - 0 1"));
+  const Move mate_move{"h6", "i6"};
+  Board mated = b;
+  mated.make_move(mate_move);
+  std::vector<TablebaseCode> queen_codes(tablebase_size(queen),
+                                         kTablebaseUnknown);
+  queen_codes[tablebase_index(mated)] = 1; // lost in 0 plies
+  tables.add(queen, std::move(queen_codes));
+  assert(tables.probe(mated)->outcome == -1);
+  assert(!tables.probe(b));
+  MinimaxBot bot(&tables);
+  assert(bot.select_move(b) == mate_move);
+}
+
+// The retrograde solver on a full three-piece table
+void test_tablebase_solver() {
+  const Material kings = *Material::from_name("wkbk");
+  const Material rook = *Material::from_name("wkbkwr");
+  common::ThreadPool pool;
+  Tablebases tables;
+  tables.add(kings, generate_tablebase(kings, tables, &pool));
+  tables.add(rook, generate_tablebase(rook, tables, &pool));
+
+  // Ra1-aG mates on the back rank
+  auto b = Board::from_fen(
+      sparse_fen({{15, "15bk"}, {13, "15wk"}, {0, "wr15"}}, "w wb - 0 1"));
+  auto result = tables.probe(b);
+  assert(result && result->outcome == 1 && result->plies == 1);
+  b.make_move({"a1", "aG"});
+  result = tables.probe(b);
+  assert(result && result->outcome == -1 && result->plies == 0);
+
+  // The king takes an undefended rook, leaving a draw
+  b = Board::from_fen(
+      sparse_fen({{15, "14wrbk"}, {0, "wk15"}}, "b wb - 0 1"));
+  result = tables.probe(b);
+  assert(result && result->outcome == 0);
+
+  // Every sampled result follows from the results after each legal move
+  common::Rng rng(11);
+  for (int checked = 0; checked < 300;) {
+    const std::string empty = sparse_fen({}, "w wb - 0 1");
+    b = Board::from_fen(empty);
+    std::vector<Square> squares;
+    while (squares.size() < 3) {
+      const Square square = rng.below(256);
+      if (std::find(squares.begin(), squares.end(), square) == squares.end())
+        squares.push_back(square);
+    }
+    for (std::size_t i = 0; i < 3; i++)
+      b.place_piece(unpack_piece(rook.pieces[i]), to_coord(squares[i]));
+    b.player_to_move() = rng.below(2) ? Player::Player1 : Player::Player2;
+    result = tables.probe(b);
+    if (!result)
+      continue;
+    checked++;
+
+    const auto moves = Game::get_legal_moves(b);
+    bool all_known = true, draw = false;
+    int shortest_win = 0, longest_loss = 0; // in plies, 0 for none
+    for (const Move &move : moves) {
+      Board next = b;
+      next.make_move(move);
+      auto after = tables.probe(next);
+      if (!after)
+        all_known = false;
+      else if (after->outcome < 0 &&
+               (!shortest_win || after->plies + 1 < shortest_win))
+        shortest_win = after->plies + 1;
+      else if (after->outcome == 0)
+        draw = true;
+      else if (after->outcome > 0)
+        longest_loss = std::max(longest_loss, after->plies + 1);
+    }
+    if (result->outcome == 1) {
+      assert(shortest_win == result->plies);
+    } else {
+      assert(all_known && !shortest_win);
+      if (result->outcome == -1)
+        assert(!draw && longest_loss == result->plies);
+      else
+        assert(draw || moves.empty());
+    }
+  }
+}
+
+// The generic perft and bots on standard chess, with published node counts
+void test_generic_game() {
+  const auto chess_start = chess::Board::from_fen(
+      "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+  const std::vector<uint64_t> counts = {1, 20, 400, 8902};
+  for (std::size_t depth = 0; depth < counts.size(); depth++)
+    assert(common::perft<chess::Game>(chess_start, depth) == counts[depth]);
+
+  // Back rank mate
+  auto b = chess::Board::from_fen("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1");
+  BasicMinimaxBot<chess::Game> minimax;
+  assert(minimax.select_move(b) == (chess::Move{{0, 0}, {7, 0}, {}}));
+
+  BasicRandomBot<chess::Game> random(1);
+  auto move = random.select_move(b);
+  const auto legal_moves = chess::Game::get_legal_moves(b);
+  assert(move && std::find(legal_moves.begin(), legal_moves.end(), *move) !=
+                     legal_moves.end());
+}
+
+// Every possible move comes out of the picker once, hash move first and
+// captures before quiet moves
+void test_move_picker() {
+  const auto packed = [](auto moves) {
+    std::vector<PackedMove> result;
+    for (const Move &move : moves)
+      result.push_back(pack_move(move));
+    std::sort(result.begin(), result.end());
+    return result;
+  };
+  common::Rng rng(3);
+  Board b = Board::from_fen(kInitialFen);
+  for (int ply = 0; ply < 60; ply++) {
+    const auto possible = get_possible_moves(b);
+    const auto legal = Game::get_legal_moves(b);
+    if (legal.empty())
+      break;
+    common::ArenaScope scope;
+    const Move hash_move = possible[rng.below(possible.size())];
+    const MovePicker::Killers killers = {possible[rng.below(possible.size())],
+                                         Move{"a1", "p16"}};
+    MovePicker picker(b, hash_move, killers);
+    std::vector<Move> picked;
+    while (auto move = picker.next())
+      picked.push_back(*move);
+    assert(packed(picked) == packed(possible));
+    assert(picked.front() == hash_move);
+    const auto first_quiet =
+        std::find_if(picked.begin() + 1, picked.end(),
+                     [&](const Move &m) { return !is_capture(b, m); });
+    assert(std::none_of(first_quiet, picked.end(),
+                        [&](const Move &m) { return is_capture(b, m); }));
+    b.make_move(legal[rng.below(legal.size())]);
+  }
+
+  // Captures of the queen come first, the knight's before the rook's
+  b = Board::from_fen(sparse_fen({{15, "15bk"},
+                                  {8, "5bq10"},
+                                  {7, "2bp2wr10"},
+                                  {6, "4wn11"},
+                                  {0, "wk15"}},
+                                 "w wb - 0 1"));
+  common::ArenaScope scope;
+  MovePicker picker(b, {});
+  for (const char *capture : {"e7f9", "f8f9", "e7c8", "f8c8"})
+    assert(picker.next() == Move(capture));
+  assert(!is_capture(b, *picker.next()));
+}
+
+void test_alpha_beta_search() {
+  TranspositionTable table(1);
+  TranspositionTable::Entry entry;
+  entry.move = Move{"h3", "h1"};
+  entry.score = -kMateScore + 3;
+  entry.depth = 5;
+  entry.bound = TranspositionTable::Bound::Upper;
+  table.store(12345, entry);
+  auto stored = table.probe(12345);
+  assert(stored && stored->move == entry.move &&
+         stored->score == entry.score && stored->depth == 5 &&
+         stored->bound == entry.bound);
+  assert(!table.probe(12346));
+
+  // Rh3-h1 mates
+  auto b = Board::from_fen("15wk/16/16/16/16/16/16/16/16/16/16/16/16/7wr8/"
+                           "6wr9/bk15 w");
+  AlphaBetaBot bot({.depth = 3});
+  assert(bot.select_move(b) == Move("h3", "h1"));
+  assert(bot.last_result().score == kMateScore - 1);
+  assert(bot.last_result().pv.front() == Move("h3", "h1"));
+
+  // Stopped searches still return a legal move
+  std::atomic<bool> stop = true;
+  Searcher searcher(table);
+  b = Board::from_fen(kInitialFen);
+  auto result = searcher.search(b, {}, {.stop = &stop});
+  const auto legal = Game::get_legal_moves(b);
+  assert(result.best_move &&
+         std::find(legal.begin(), legal.end(), *result.best_move) !=
+             legal.end());
+  result = searcher.search(b, {}, {.depth = 3, .nodes = 500});
+  assert(result.best_move && result.nodes >= 500);
+}
+
+void test_ponder() {
+  const auto is_legal = [](const Board &board, std::optional<Move> move) {
+    const auto legal = Game::get_legal_moves(board);
+    return move && std::find(legal.begin(), legal.end(), *move) != legal.end();
+  };
+  Board b = Board::from_fen(kInitialFen);
+  AlphaBetaBot bot({.depth = 2}, nullptr, 1);
+  b.make_move(*bot.select_move(b));
+
+  // Every reply is searched, so whichever is played is a ponder hit
+  bot.ponder(b, {}, false);
+  while (bot.ponder_step()) {
+  }
+  b.make_move(Game::get_legal_moves(b).back());
+  auto move = bot.select_move(b);
+  assert(bot.ponder_hits() == 1 && is_legal(b, move));
+  b.make_move(*move);
+
+  // The same in the background
+  bot.ponder(b);
+  bot.wait_for_ponder();
+  b.make_move(Game::get_legal_moves(b).front());
+  move = bot.select_move(b);
+  assert(bot.ponder_hits() == 2 && is_legal(b, move));
+  b.make_move(*move);
+
+  // A move that arrives mid-ponder interrupts it
+  bot.ponder(b);
+  b.make_move(Game::get_legal_moves(b).front());
+  move = bot.select_move(b);
+  assert(is_legal(b, move));
+
+  // Stepping in small slices resumes each reply until all are searched
+  b = Board::from_fen(kInitialFen);
+  AlphaBetaBot sliced({.depth = 3}, nullptr, 1);
+  b.make_move(*sliced.select_move(b));
+  sliced.ponder(b, {}, false);
+  const int replies = Game::get_legal_moves(b).size();
+  int steps = 1;
+  while (sliced.ponder_step(100))
+    steps++;
+  assert(steps > replies);
+  b.make_move(Game::get_legal_moves(b).back());
+  move = sliced.select_move(b);
+  assert(sliced.ponder_hits() == 1 && is_legal(b, move));
+}
+
+// Node counts from positions exercising castling and defection
+void test_perft_golden() {
+  const std::string castle_fen = sparse_fen(
+      {{15, "4br3bk2br4"}, {0, "4wr3wk2wr4"}}, "w wb KQkq 0 1");
+  const std::string defect_fen = sparse_fen(
+      {{15, "8bk7"}, {11, "4wn11"}, {0, "8wk7"}}, "w wb - 0 1");
+  const std::vector<std::pair<std::string, std::vector<uint64_t>>> cases = {
+      {kInitialFen, {1, 20, 400, 9940}},
+      {castle_fen, {1, 50, 2172, 104989}},
+      {defect_fen, {1, 14, 68, 904}},
+  };
+  for (const auto &[fen, counts] : cases) {
+    auto b = Board::from_fen(fen);
+    for (std::size_t depth = 0; depth < counts.size(); depth++)
+      assert(perft(b, depth) == counts[depth]);
+  }
+}
+
+// The move generator agrees with the plain one it's fuzzed against
+void test_reference_movegen() {
+  const auto sorted = [](std::vector<Move> moves) {
+    std::vector<PackedMove> packed;
+    for (const Move &move : moves)
+      packed.push_back(pack_move(move));
+    std::sort(packed.begin(), packed.end());
+    return packed;
+  };
+  const std::vector<std::string> fens = {
+      kInitialFen,
+      sparse_fen({{15, "4br3bk2br4"}, {7, "9br6"}, {0, "4wr3wk2wr4"}},
+                 "w wb KQkq 0 1"),
+      sparse_fen({{15, "8bk7"}, {11, "4nn11"}, {4, "4rn11"}, {0, "8wk7"}},
+                 "w wb - 0 1"),
+  };
+  common::Rng rng(7);
+  for (const std::string &fen : fens) {
+    Board b = Board::from_fen(fen);
+    for (int ply = 0; ply < 40; ply++) {
+      auto position = reference::Position::from_board(b);
+      for (int color = 1; color < 13; color++) {
+        const Color c = static_cast<Color>(color);
+        assert(b.controlling_player(c) ==
+               reference::controlling_player(position, c));
+      }
+      assert(sorted(get_possible_moves(b)) ==
+             sorted(reference::possible_moves(position)));
+      const auto legal_moves = Game::get_legal_moves(b);
+      assert(sorted(legal_moves) == sorted(reference::legal_moves(position)));
+      assert(is_in_check(b) == reference::is_in_check(position));
+      if (legal_moves.empty())
+        break;
+      const Move move = legal_moves[rng.below(legal_moves.size())];
+      b.make_move(move);
+      position.make_move(move);
+      assert(reference::Position::from_board(b) == position);
+    }
+  }
+}
+
 void test_control() {
   {
     auto b = Board::from_fen(
@@ -280,7 +1229,30 @@ int main(int argc, char **argv) {
   using namespace sovereign_chess;
   print_board_colors();
   test_coords();
+  test_packed_board();
+  test_square_set();
+  test_piece_sets();
+  test_fen();
+  test_binary_position();
+  test_batch();
+  test_random_bot();
+  test_mcts_bot();
+  test_arena();
+  test_lru_cache();
+  test_perft();
+  test_perft_golden();
+  test_reference_movegen();
+  test_generic_game();
+  test_move_picker();
+  test_alpha_beta_search();
+  test_ponder();
+  test_position_history();
+  test_opening_book();
+  test_tablebase();
+  test_tablebase_solver();
   test_control();
+  test_castling();
+  test_defection();
 
   test_rule_5();
   test_rule_6();
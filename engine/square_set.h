@@ -0,0 +1,156 @@
+// Sets of board squares and vectorized scans over a byte-per-square board
+#pragma once
+#include <array>
+#include <bit>
+#include <cstdint>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+namespace sovereign_chess {
+
+// Squares are indexed rank * 16 + file
+using Square = uint8_t;
+
+// Set of colors, bit c for Color c
+using ColorMask = uint16_t;
+
+// Set of the 256 squares, iterated in ascending order
+class SquareSet {
+public:
+  class iterator {
+  public:
+    iterator(const std::array<uint64_t, 4> &words, int word)
+        : words_(words), word_(word) {
+      skip_empty();
+    }
+    Square operator*() const {
+      return word_ * 64 + std::countr_zero(words_[word_]);
+    }
+    iterator &operator++() {
+      words_[word_] &= words_[word_] - 1;
+      skip_empty();
+      return *this;
+    }
+    bool operator==(const iterator &other) const {
+      return word_ == other.word_ && (word_ == 4 || words_ == other.words_);
+    }
+
+  private:
+    void skip_empty() {
+      while (word_ < 4 && !words_[word_])
+        word_++;
+    }
+    std::array<uint64_t, 4> words_;
+    int word_;
+  };
+
+  constexpr void insert(Square square) {
+    words_[square >> 6] |= uint64_t{1} << (square & 63);
+  }
+  constexpr void erase(Square square) {
+    words_[square >> 6] &= ~(uint64_t{1} << (square & 63));
+  }
+  constexpr bool contains(Square square) const {
+    return words_[square >> 6] >> (square & 63) & 1;
+  }
+  int size() const {
+    int count = 0;
+    for (uint64_t word : words_)
+      count += std::popcount(word);
+    return count;
+  }
+  bool empty() const {
+    return !(words_[0] | words_[1] | words_[2] | words_[3]);
+  }
+  SquareSet &operator|=(const SquareSet &other) {
+    for (int i = 0; i < 4; i++)
+      words_[i] |= other.words_[i];
+    return *this;
+  }
+  bool operator==(const SquareSet &other) const = default;
+
+  iterator begin() const { return iterator(words_, 0); }
+  iterator end() const { return iterator(words_, 4); }
+
+  std::array<uint64_t, 4> words_{};
+};
+
+/** Squares whose byte has its low nibble (the piece color) in colors.
+ *
+ * colors should not include bit 0, which is what empty squares hold. The
+ * scalar version is the reference; the others map each nibble through a
+ * 16-entry byte table with a shuffle and collect the high bits.
+ */
+inline SquareSet squares_with_colors_scalar(const uint8_t *squares,
+                                            ColorMask colors) {
+  SquareSet set;
+  for (int word = 0; word < 4; word++) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 64; i++)
+      bits |= uint64_t{colors >> (squares[word * 64 + i] & 0xf) & 1u} << i;
+    set.words_[word] = bits;
+  }
+  return set;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2"))) inline SquareSet
+squares_with_colors_avx2(const uint8_t *squares, ColorMask colors) {
+  alignas(16) uint8_t lookup[16];
+  for (int color = 0; color < 16; color++)
+    lookup[color] = colors >> color & 1 ? 0xff : 0;
+  const __m256i table = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i *>(lookup)));
+  const __m256i low_nibble = _mm256_set1_epi8(0x0f);
+
+  SquareSet set;
+  for (int i = 0; i < 8; i++) {
+    __m256i bytes =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(squares + i * 32));
+    __m256i hits =
+        _mm256_shuffle_epi8(table, _mm256_and_si256(bytes, low_nibble));
+    uint32_t bits = _mm256_movemask_epi8(hits);
+    set.words_[i / 2] |= uint64_t{bits} << (i % 2 * 32);
+  }
+  return set;
+}
+#elif defined(__wasm_simd128__)
+inline SquareSet squares_with_colors_wasm(const uint8_t *squares,
+                                          ColorMask colors) {
+  alignas(16) uint8_t lookup[16];
+  for (int color = 0; color < 16; color++)
+    lookup[color] = colors >> color & 1 ? 0xff : 0;
+  const v128_t table = wasm_v128_load(lookup);
+  const v128_t low_nibble = wasm_i8x16_splat(0x0f);
+
+  SquareSet set;
+  for (int i = 0; i < 16; i++) {
+    v128_t bytes = wasm_v128_load(squares + i * 16);
+    v128_t hits = wasm_i8x16_swizzle(table, wasm_v128_and(bytes, low_nibble));
+    uint64_t bits = wasm_i8x16_bitmask(hits);
+    set.words_[i / 4] |= bits << (i % 4 * 16);
+  }
+  return set;
+}
+#endif
+
+// squares must point at 256 bytes
+inline SquareSet squares_with_colors(const uint8_t *squares,
+                                     ColorMask colors) {
+#if defined(__x86_64__) || defined(__i386__)
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+    return squares_with_colors_avx2(squares, colors);
+  return squares_with_colors_scalar(squares, colors);
+#elif defined(__wasm_simd128__)
+  return squares_with_colors_wasm(squares, colors);
+#else
+  return squares_with_colors_scalar(squares, colors);
+#endif
+}
+
+} // namespace sovereign_chess
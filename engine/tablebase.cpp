@@ -0,0 +1,569 @@
+#include "tablebase.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <fstream>
+
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+namespace {
+// Rotating the board half a turn maps every colored square to the other
+// square of the same color, and every move to a move
+constexpr bool colors_symmetric() {
+  for (int square = 0; square < 256; square++) {
+    if (kSquareColors[square] != kSquareColors[255 - square])
+      return false;
+  }
+  return true;
+}
+static_assert(colors_symmetric());
+
+// Steps in the 0x88-style index. Moves are reversible, so the same steps
+// lead back to where a piece came from.
+constexpr std::array<int, 4> kOrthogonalSteps = {
+    x88_step({1, 0}), x88_step({0, 1}), x88_step({0, -1}), x88_step({-1, 0})};
+constexpr std::array<int, 4> kDiagonalSteps = {
+    x88_step({1, 1}), x88_step({1, -1}), x88_step({-1, 1}),
+    x88_step({-1, -1})};
+constexpr std::array<int, 8> kKingSteps = {
+    kOrthogonalSteps[0], kOrthogonalSteps[1], kOrthogonalSteps[2],
+    kOrthogonalSteps[3], kDiagonalSteps[0],   kDiagonalSteps[1],
+    kDiagonalSteps[2],   kDiagonalSteps[3]};
+constexpr std::array<int, 8> kKnightSteps = {
+    x88_step({2, 1}),   x88_step({2, -1}), x88_step({1, 2}),
+    x88_step({1, -2}),  x88_step({-1, 2}), x88_step({-1, -2}),
+    x88_step({-2, 1}),  x88_step({-2, -1})};
+
+constexpr ColorMask kAllColors = 0x1ffe;
+constexpr std::size_t kChunkSize = 1 << 16;
+
+using Squares = std::array<Square, Material::kMaxPieces>;
+
+// Per-position state while solving
+enum Flags : uint8_t {
+  kValid = 1,        // the player who just moved isn't in check
+  kDecided = 2,      // won or lost, with its code set
+  kUnknownChild = 4, // a move leads to a position with no known result
+  kEscape = 8,       // a move out of the table doesn't lose
+  kUnknown = 16,     // can reach a position with no known result
+};
+
+constexpr int kMaxPlies = 253;
+
+Player owner(const Material &material, std::size_t index) {
+  if (index < 2)
+    return static_cast<Player>(index);
+  return color_of(material.pieces[index]) == color_of(material.pieces[0])
+             ? Player::Player1
+             : Player::Player2;
+}
+
+uint64_t encode(std::size_t count, Squares squares, Player to_move) {
+  if (squares[0] >= 128) {
+    for (std::size_t i = 0; i < count; i++)
+      squares[i] = 255 - squares[i];
+  }
+  uint64_t index = 0;
+  for (std::size_t i = count; i-- > 1;)
+    index = index * 256 + squares[i];
+  index = index * 128 + squares[0];
+  return index * 2 + static_cast<uint64_t>(to_move);
+}
+
+Player decode(std::size_t count, uint64_t index, Squares &squares) {
+  const Player to_move = static_cast<Player>(index & 1);
+  index >>= 1;
+  squares[0] = index % 128;
+  index /= 128;
+  for (std::size_t i = 1; i < count; i++) {
+    squares[i] = index % 256;
+    index /= 256;
+  }
+  return to_move;
+}
+
+/** Whether the squares can hold the pieces: no two share a square, or both
+ * squares of one color. Only captures, which leave the table, can fill both
+ * squares of a color, and the controller of such a color depends on which
+ * square comes first, which would break the symmetry.
+ */
+bool placeable(std::size_t count, const Squares &squares) {
+  for (std::size_t i = 0; i < count; i++) {
+    for (std::size_t j = i + 1; j < count; j++) {
+      if (squares[i] == squares[j] ||
+          (kSquareColors[squares[i]] != Color::Empty &&
+           kOtherSquareOfSameColor[squares[i]] == squares[j]))
+        return false;
+    }
+  }
+  return true;
+}
+
+Board make_board(const Material &material, const Squares &squares,
+                 Player to_move) {
+  Board board;
+  for (Player player : {Player::Player1, Player::Player2}) {
+    board.owned_color(player) =
+        color_of(material.pieces[static_cast<int>(player)]);
+    for (Castle side : {Castle::Kingside, Castle::Queenside})
+      board.castle_right(player, side) = false;
+  }
+  for (std::size_t i = 0; i < material.pieces.size(); i++)
+    board.place_piece(unpack_piece(material.pieces[i]), to_coord(squares[i]));
+  board.player_to_move() = to_move;
+  return board;
+}
+
+// Whether the player who made the move left their king in check
+bool exposes_king(const Board &board, const Move &move) {
+  Board next = board;
+  next.make_move(move);
+  next.player_to_move() = board.player_to_move();
+  return is_in_check(next);
+}
+
+/** Calls fn with the index of every legal position one quiet move before
+ * the given one: each piece of the player who just moved steps back the way
+ * it came, to a square that was empty. The move must also have been allowed
+ * to land where the piece stands now.
+ */
+template <typename F>
+void for_each_predecessor(const Material &material, const Squares &squares,
+                          Player to_move, F &&fn) {
+  const std::size_t count = material.pieces.size();
+  const Player mover = other_player(to_move);
+  auto occupied = [&](int square) {
+    for (std::size_t i = 0; i < count; i++) {
+      if (squares[i] == square)
+        return true;
+    }
+    return false;
+  };
+
+  for (std::size_t i = 0; i < count; i++) {
+    if (owner(material, i) != mover)
+      continue;
+    const Square dest = squares[i];
+    const Color color = color_of(material.pieces[i]);
+    const Color dest_color = kSquareColors[dest];
+    if (dest_color == color ||
+        (dest_color != Color::Empty &&
+         occupied(kOtherSquareOfSameColor[dest])))
+      continue;
+
+    auto visit = [&](Square src) {
+      if (dest_color != Color::Empty && src == kOtherSquareOfSameColor[dest])
+        return;
+      Squares before = squares;
+      before[i] = src;
+      fn(encode(count, before, mover));
+    };
+    auto leaps = [&](const auto &steps) {
+      for (int step : steps) {
+        const int x88 = to_x88(dest) + step;
+        if (!off_board(x88) && !occupied(from_x88(x88)))
+          visit(from_x88(x88));
+      }
+    };
+    auto slides = [&](const auto &steps) {
+      for (int step : steps) {
+        for (int x88 = to_x88(dest) + step;
+             !off_board(x88) && !occupied(from_x88(x88)); x88 += step)
+          visit(from_x88(x88));
+      }
+    };
+
+    switch (type_of(material.pieces[i])) {
+    case PieceType::King:
+      leaps(kKingSteps);
+      break;
+    case PieceType::Knight:
+      leaps(kKnightSteps);
+      break;
+    case PieceType::Bishop:
+      slides(kDiagonalSteps);
+      break;
+    case PieceType::Rook:
+      slides(kOrthogonalSteps);
+      break;
+    case PieceType::Queen:
+      slides(kOrthogonalSteps);
+      slides(kDiagonalSteps);
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+// Pieces of the board in Material order with their squares, or false if a
+// table can't describe it
+bool describe(const Board &board, Material &material, Squares &squares) {
+  const SquareSet occupied = board.pieces(kAllColors);
+  if (occupied.size() > static_cast<int>(Material::kMaxPieces))
+    return false;
+  for (Player player : {Player::Player1, Player::Player2}) {
+    for (Castle side : {Castle::Kingside, Castle::Queenside}) {
+      if (board.castle_right(player, side))
+        return false;
+    }
+  }
+
+  const PackedPiece kings[2] = {
+      pack_piece({PieceType::King, board.owned_color(Player::Player1)}),
+      pack_piece({PieceType::King, board.owned_color(Player::Player2)})};
+  std::array<std::pair<PackedPiece, Square>, Material::kMaxPieces> pieces;
+  std::size_t count = 0;
+  int kings_found = 0;
+  for (Square square : occupied) {
+    const PackedPiece piece = board.packed_at(square);
+    if (piece == kings[0] || piece == kings[1]) {
+      squares[piece == kings[0] ? 0 : 1] = square;
+      kings_found++;
+    } else {
+      pieces[count++] = {piece, square};
+    }
+  }
+  if (kings_found != 2)
+    return false;
+
+  for (std::size_t i = 1; i < count; i++) { // insertion sort
+    for (std::size_t j = i; j > 0 && pieces[j] < pieces[j - 1]; j--)
+      std::swap(pieces[j], pieces[j - 1]);
+  }
+  material.pieces = {kings[0], kings[1]};
+  for (std::size_t i = 0; i < count; i++) {
+    material.pieces.push_back(pieces[i].first);
+    squares[i + 2] = pieces[i].second;
+  }
+  return material.valid();
+}
+
+} // namespace
+
+std::optional<Material> Material::from_name(std::string_view name) {
+  if (name.size() % 2 != 0)
+    return {};
+  Material material;
+  for (std::size_t i = 0; i < name.size(); i += 2) {
+    const Color color = name_to_color(name[i]);
+    const PieceType type = common::name_to_piece_type(name[i + 1]);
+    if (color == Color::Empty || type == PieceType::Invalid)
+      return {};
+    material.pieces.push_back(pack_piece({type, color}));
+  }
+  if (material.pieces.size() > 2)
+    std::sort(material.pieces.begin() + 2, material.pieces.end());
+  if (!material.valid())
+    return {};
+  return material;
+}
+
+std::optional<Material> Material::from_board(const Board &board) {
+  Material material;
+  Squares squares;
+  if (!describe(board, material, squares))
+    return {};
+  return material;
+}
+
+std::string Material::name() const {
+  std::string name;
+  for (PackedPiece piece : pieces) {
+    name += color_names.at(color_of(piece));
+    name += common::piece_names.at(type_of(piece));
+  }
+  return name;
+}
+
+bool Material::valid() const {
+  if (pieces.size() < 2 || pieces.size() > kMaxPieces)
+    return false;
+  const Color owned[2] = {color_of(pieces[0]), color_of(pieces[1])};
+  if (type_of(pieces[0]) != PieceType::King ||
+      type_of(pieces[1]) != PieceType::King || owned[0] == owned[1] ||
+      owned[0] == Color::Empty || owned[1] == Color::Empty)
+    return false;
+  for (std::size_t i = 2; i < pieces.size(); i++) {
+    const PieceType type = type_of(pieces[i]);
+    if (type == PieceType::Pawn || type == PieceType::King ||
+        type == PieceType::Invalid ||
+        (color_of(pieces[i]) != owned[0] && color_of(pieces[i]) != owned[1]))
+      return false;
+    if (i > 2 && pieces[i] < pieces[i - 1])
+      return false;
+  }
+  return true;
+}
+
+Material Material::without(std::size_t index) const {
+  Material material = *this;
+  material.pieces.erase(material.pieces.begin() + index);
+  return material;
+}
+
+std::size_t tablebase_size(const Material &material) {
+  std::size_t size = 2 * 128;
+  for (std::size_t i = 1; i < material.pieces.size(); i++)
+    size *= 256;
+  return size;
+}
+
+uint64_t tablebase_index(const Board &board) {
+  Material material;
+  Squares squares;
+  describe(board, material, squares);
+  return encode(material.pieces.size(), squares, board.player_to_move());
+}
+
+bool Tablebases::load(const std::string &path) {
+  auto file = std::make_unique<MappedFile>(path);
+  if (!file->is_open() || file->size() < kTablebaseHeaderSize)
+    return false;
+  const uint8_t *data = file->data();
+  if (std::memcmp(data, kTablebaseMagic, 4) != 0 ||
+      data[4] != kTablebaseVersion || data[5] > Material::kMaxPieces)
+    return false;
+  Material material;
+  material.pieces.assign(data + 6, data + 6 + data[5]);
+  if (!material.valid() ||
+      file->size() != kTablebaseHeaderSize + tablebase_size(material))
+    return false;
+
+  Table &table = tables_[material.name()];
+  table.codes = data + kTablebaseHeaderSize;
+  table.file = std::move(file);
+  return true;
+}
+
+void Tablebases::add(const Material &material,
+                     std::vector<TablebaseCode> codes) {
+  Table &table = tables_[material.name()];
+  table.file.reset();
+  table.owned_codes = std::move(codes);
+  table.codes = table.owned_codes.data();
+}
+
+bool Tablebases::contains(const Material &material) const {
+  return tables_.contains(material.name());
+}
+
+std::optional<TablebaseResult> Tablebases::probe(const Board &board) const {
+  Material material;
+  Squares squares;
+  if (tables_.empty() || !describe(board, material, squares))
+    return {};
+  auto table = tables_.find(material.name());
+  if (table == tables_.end())
+    return {};
+
+  const TablebaseCode code = table->second.codes[encode(
+      material.pieces.size(), squares, board.player_to_move())];
+  if (code == kTablebaseUnknown)
+    return {};
+  if (code == kTablebaseDraw)
+    return TablebaseResult{0, 0};
+  const int plies = code - 1;
+  return TablebaseResult{plies % 2 ? 1 : -1, plies};
+}
+
+/** Retrograde analysis. A forward pass over every position finds the legal
+ * ones, counts their moves within the table and looks up the results of
+ * moves out of it. Then, in order of distance to mate, each lost position
+ * makes the positions one move before it won, and each won position counts
+ * down the moves left to the positions before it, which are lost once every
+ * move is. What remains is drawn, or unknown if it can reach a position with
+ * no known result.
+ */
+std::vector<TablebaseCode> generate_tablebase(const Material &material,
+                                              const Tablebases &smaller,
+                                              common::ThreadPool *pool) {
+  const std::size_t count = material.pieces.size();
+  const std::size_t size = tablebase_size(material);
+  std::vector<TablebaseCode> codes(size, kTablebaseUnknown);
+  std::vector<uint8_t> flags(size, 0);
+
+  auto for_each_chunk = [&](auto &&fn) {
+    const std::size_t chunks = (size + kChunkSize - 1) / kChunkSize;
+    auto run = [&](std::size_t chunk) {
+      const std::size_t end = std::min(size, (chunk + 1) * kChunkSize);
+      for (std::size_t index = chunk * kChunkSize; index < end; index++)
+        fn(index);
+    };
+    if (pool)
+      pool->parallel_for(chunks, run);
+    else
+      for (std::size_t chunk = 0; chunk < chunks; chunk++)
+        run(chunk);
+  };
+
+  for_each_chunk([&](std::size_t index) {
+    Squares squares;
+    const Player to_move = decode(count, index, squares);
+    if (!placeable(count, squares))
+      return;
+    Board board = make_board(material, squares, other_player(to_move));
+    if (!is_in_check(board))
+      flags[index] = kValid;
+  });
+
+  // Kings alone can never checkmate
+  if (count == 2) {
+    for (std::size_t index = 0; index < size; index++) {
+      if (flags[index] & kValid)
+        codes[index] = kTablebaseDraw;
+    }
+    return codes;
+  }
+
+  // Moves left to try, the longest mate against the position through moves
+  // out of the table, and the shortest mate by it through such moves (in
+  // plies + 1, 0 for none)
+  std::vector<uint8_t> moves_left(size, 0);
+  std::vector<uint8_t> longest_loss(size, 0);
+  std::vector<uint8_t> shortest_win(size, 0);
+  for_each_chunk([&](std::size_t index) {
+    if (!(flags[index] & kValid))
+      return;
+    Squares squares;
+    const Player to_move = decode(count, index, squares);
+    const Board board = make_board(material, squares, to_move);
+
+    common::ArenaScope scope;
+    MoveList moves = make_move_list();
+    get_possible_moves(board, moves);
+    int legal = 0;
+    for (const Move &move : moves) {
+      const Square src = to_square(move.src), dest = to_square(move.dest);
+      if (move.is_defection() || board.packed_at(dest) != kNoPiece) {
+        if (exposes_king(board, move))
+          continue;
+        legal++;
+        Board next = board;
+        next.make_move(move);
+        auto result = smaller.probe(next);
+        if (!result || result->plies + 1 > kMaxPlies) {
+          flags[index] |= kUnknownChild;
+        } else if (result->outcome < 0) {
+          flags[index] |= kEscape;
+          const int plies = result->plies + 1;
+          if (!shortest_win[index] || plies + 1 < shortest_win[index])
+            shortest_win[index] = plies + 1;
+        } else if (result->outcome == 0) {
+          flags[index] |= kEscape;
+        } else {
+          longest_loss[index] = std::max<int>(longest_loss[index],
+                                              result->plies + 1 + 1);
+        }
+        continue;
+      }
+
+      Squares after = squares;
+      for (std::size_t i = 0; i < count; i++) {
+        if (after[i] == src)
+          after[i] = dest;
+      }
+      if (!(flags[encode(count, after, other_player(to_move))] & kValid))
+        continue;
+      legal++;
+      moves_left[index]++;
+    }
+
+    if (legal == 0) {
+      if (is_in_check(board)) {
+        shortest_win[index] = 0;
+        longest_loss[index] = 1; // checkmated
+      } else {
+        flags[index] |= kDecided; // stalemate
+        codes[index] = kTablebaseDraw;
+      }
+    }
+  });
+
+  // Positions to decide at each number of plies
+  std::vector<std::vector<uint32_t>> pending(kMaxPlies + 1);
+  for (std::size_t index = 0; index < size; index++) {
+    if (!(flags[index] & kValid) || flags[index] & kDecided)
+      continue;
+    if (shortest_win[index])
+      pending[shortest_win[index] - 1].push_back(index);
+    else if (moves_left[index] == 0 && longest_loss[index] &&
+             !(flags[index] & (kEscape | kUnknownChild)))
+      pending[longest_loss[index] - 1].push_back(index);
+  }
+
+  for (int plies = 0; plies <= kMaxPlies; plies++) {
+    const bool lost = plies % 2 == 0;
+    for (std::size_t i = 0; i < pending[plies].size(); i++) {
+      const uint32_t index = pending[plies][i];
+      if (flags[index] & kDecided)
+        continue;
+      flags[index] |= kDecided;
+      codes[index] = plies + 1;
+
+      Squares squares;
+      const Player to_move = decode(count, index, squares);
+      for_each_predecessor(material, squares, to_move, [&](uint64_t before) {
+        if (!(flags[before] & kValid) || flags[before] & kDecided)
+          return;
+        if (plies == kMaxPlies) {
+          flags[before] |= kUnknownChild;
+        } else if (lost) {
+          pending[plies + 1].push_back(before);
+        } else if (--moves_left[before] == 0 &&
+                   !(flags[before] & (kEscape | kUnknownChild))) {
+          pending[std::max<int>(plies + 1, longest_loss[before] - 1)]
+              .push_back(before);
+        }
+      });
+    }
+    std::vector<uint32_t>().swap(pending[plies]);
+  }
+
+  // Undecided positions that can reach an unknown one are unknown too
+  std::vector<uint32_t> unknown;
+  for (std::size_t index = 0; index < size; index++) {
+    if ((flags[index] & (kValid | kDecided | kUnknownChild)) ==
+        (kValid | kUnknownChild)) {
+      flags[index] |= kUnknown;
+      unknown.push_back(index);
+    }
+  }
+  while (!unknown.empty()) {
+    const uint32_t index = unknown.back();
+    unknown.pop_back();
+    Squares squares;
+    const Player to_move = decode(count, index, squares);
+    for_each_predecessor(material, squares, to_move, [&](uint64_t before) {
+      if ((flags[before] & (kValid | kDecided | kUnknown)) == kValid) {
+        flags[before] |= kUnknown;
+        unknown.push_back(before);
+      }
+    });
+  }
+
+  for (std::size_t index = 0; index < size; index++) {
+    if ((flags[index] & (kValid | kDecided | kUnknown)) == kValid)
+      codes[index] = kTablebaseDraw;
+  }
+  return codes;
+}
+
+bool write_tablebase(const std::string &path, const Material &material,
+                     const std::vector<TablebaseCode> &codes) {
+  char header[kTablebaseHeaderSize] = {};
+  std::memcpy(header, kTablebaseMagic, 4);
+  header[4] = kTablebaseVersion;
+  header[5] = static_cast<char>(material.pieces.size());
+  std::memcpy(header + 6, material.pieces.data(), material.pieces.size());
+
+  std::ofstream out(path, std::ios::binary);
+  out.write(header, sizeof(header));
+  out.write(reinterpret_cast<const char *>(codes.data()), codes.size());
+  return static_cast<bool>(out);
+}
+
+} // namespace sovereign_chess
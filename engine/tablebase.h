@@ -0,0 +1,119 @@
+// Endgame tablebases: exact results for positions with few pieces, solved by
+// retrograde analysis
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "binary_position.h"
+#include "sovereign_chess.h"
+
+namespace common {
+class ThreadPool;
+} // namespace common
+
+namespace sovereign_chess {
+
+/** Pieces of a table: Player 1's king, Player 2's king, then the other
+ * pieces in ascending PackedPiece order. The kings' colors are the owned
+ * colors, and every other piece has one of them, so each piece always
+ * belongs to the same player. Pawns are not supported.
+ */
+struct Material {
+  std::vector<PackedPiece> pieces;
+
+  // Pieces as in FEN, e.g. "wkbkwq"
+  static std::optional<Material> from_name(std::string_view name);
+  // Empty if the board has pieces a table can't describe, or castle rights
+  static std::optional<Material> from_board(const Board &board);
+  std::string name() const;
+
+  // Tables of more pieces are too large to build in memory
+  static constexpr std::size_t kMaxPieces = 3;
+  bool valid() const;
+
+  // The material after the piece at index is captured
+  Material without(std::size_t index) const;
+
+  bool operator==(const Material &other) const = default;
+};
+
+// Result for the player to move, with best play on both sides
+struct TablebaseResult {
+  int outcome; // 1 win, 0 draw, -1 loss
+  int plies;   // until checkmate, 0 for draws
+};
+
+/** Table files are a 16 byte header followed by one byte per position.
+ * - bytes 0-3: "SCTB"
+ * - byte 4: version
+ * - byte 5: number of pieces
+ * - bytes 6-15: the pieces of the Material, then zeros
+ *
+ * Positions are indexed by the squares of the pieces (rank * 16 + file) and
+ * the player to move:
+ *   index = player + 2 * (square[0] + 128 * (square[1] + 256 * ...))
+ * The board looks the same rotated 180 degrees, so positions with Player 1's
+ * king on the upper half are rotated (square -> 255 - square) first. Each
+ * byte is a TablebaseCode.
+ */
+constexpr char kTablebaseMagic[5] = "SCTB";
+constexpr uint8_t kTablebaseVersion = 1;
+constexpr std::size_t kTablebaseHeaderSize = 16;
+
+/** 0 for a draw, kTablebaseUnknown for a position that isn't legal or
+ * wasn't solved, otherwise the plies until checkmate plus one: odd plies win
+ * for the player to move and even plies lose. Defecting changes the colors
+ * in the table, so positions that could defect are unknown unless they have
+ * a win without it.
+ */
+using TablebaseCode = uint8_t;
+constexpr TablebaseCode kTablebaseDraw = 0;
+constexpr TablebaseCode kTablebaseUnknown = 255;
+
+std::size_t tablebase_size(const Material &material);
+
+// Index of the board in the table of its material, which must be
+// Material::from_board(board)
+uint64_t tablebase_index(const Board &board);
+
+// Loaded tables by material, probed during search
+class Tablebases {
+public:
+  // Maps a file written by write_tablebase. False if it is missing or invalid.
+  bool load(const std::string &path);
+  // Adds a table held in memory
+  void add(const Material &material, std::vector<TablebaseCode> codes);
+
+  std::size_t size() const { return tables_.size(); }
+  bool contains(const Material &material) const;
+
+  // Empty if the material has no table or the position is unknown
+  std::optional<TablebaseResult> probe(const Board &board) const;
+
+private:
+  struct Table {
+    std::unique_ptr<MappedFile> file; // or null for codes held in memory
+    std::vector<TablebaseCode> owned_codes;
+    const TablebaseCode *codes;
+  };
+  std::unordered_map<std::string, Table> tables_; // by Material::name
+};
+
+/** Solves every position of the material. Captures lead to tables of fewer
+ * pieces, which are looked up in smaller; positions whose results depend on
+ * a missing table are unknown. Tables of kings alone are draws. The forward
+ * passes over all positions are spread across the pool, if given.
+ */
+std::vector<TablebaseCode>
+generate_tablebase(const Material &material, const Tablebases &smaller,
+                   common::ThreadPool *pool = nullptr);
+
+bool write_tablebase(const std::string &path, const Material &material,
+                     const std::vector<TablebaseCode> &codes);
+
+} // namespace sovereign_chess
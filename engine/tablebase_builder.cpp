@@ -0,0 +1,111 @@
+// Builds endgame tablebases, along with the smaller tables they depend on.
+//
+// Usage: tablebase_builder DIR MATERIAL... [--threads N]
+// Each MATERIAL names the pieces as in FEN, Player 1's king first, e.g.
+// "wkbkwq" for a white king and queen against a black king. Tables are
+// written to DIR/<material>.sctb; tables already there are loaded instead of
+// built again.
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "tablebase.h"
+#include "thread_pool.h"
+
+namespace sovereign_chess {
+
+struct Options {
+  std::string directory;
+  std::vector<Material> materials;
+  unsigned threads = common::ThreadPool::default_workers() + 1;
+};
+
+std::optional<Options> parse_options(int argc, char **argv) {
+  if (argc < 3) {
+    std::cerr << "Usage: tablebase_builder DIR MATERIAL... [--threads N]\n";
+    return {};
+  }
+  Options options;
+  options.directory = argv[1];
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--threads" && i + 1 < argc) {
+      options.threads = std::stoi(argv[++i]);
+      continue;
+    }
+    auto material = Material::from_name(arg);
+    if (!material) {
+      std::cerr << "Unsupported material " << arg << "\n";
+      return {};
+    }
+    options.materials.push_back(*material);
+  }
+  return options;
+}
+
+// The material and every material reachable from it by captures, fewest
+// pieces first
+void add_with_dependencies(const Material &material,
+                           std::vector<Material> &order) {
+  for (std::size_t i = 2; i < material.pieces.size(); i++)
+    add_with_dependencies(material.without(i), order);
+  if (std::find(order.begin(), order.end(), material) == order.end())
+    order.push_back(material);
+}
+
+void print_summary(const std::vector<TablebaseCode> &codes) {
+  std::size_t wins = 0, losses = 0, draws = 0, unknown = 0;
+  int longest = 0;
+  for (TablebaseCode code : codes) {
+    if (code == kTablebaseDraw) {
+      draws++;
+    } else if (code == kTablebaseUnknown) {
+      unknown++;
+    } else {
+      (code % 2 == 0 ? wins : losses)++;
+      longest = std::max(longest, code - 1);
+    }
+  }
+  std::cout << "  wins " << wins << ", losses " << losses << ", draws "
+            << draws << ", unknown or illegal " << unknown
+            << ", longest mate " << longest << " plies\n";
+}
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  auto options = parse_options(argc, argv);
+  if (!options)
+    return 1;
+
+  std::vector<Material> order;
+  for (const Material &material : options->materials)
+    add_with_dependencies(material, order);
+
+  common::ThreadPool pool(std::max(options->threads, 1u) - 1);
+  Tablebases tables;
+  for (const Material &material : order) {
+    const std::string path =
+        options->directory + "/" + material.name() + ".sctb";
+    if (tables.load(path)) {
+      std::cout << "Loaded " << path << "\n";
+      continue;
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto codes = generate_tablebase(material, tables, &pool);
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::cout << "Built " << material.name() << " in " << elapsed.count()
+              << "s\n";
+    print_summary(codes);
+    if (!write_tablebase(path, material, codes)) {
+      std::cerr << "Failed to write " << path << "\n";
+      return 1;
+    }
+    tables.add(material, std::move(codes));
+  }
+  return 0;
+}
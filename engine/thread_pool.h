@@ -0,0 +1,111 @@
+// Fixed-size worker pool for fanning work out across threads
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace common {
+
+class ThreadPool {
+public:
+  // Without pthread support (plain emscripten builds) the pool has no workers
+  // and everything runs on the calling thread.
+  static unsigned default_workers() {
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+    return 0;
+#else
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware > 1 ? hardware - 1 : 0;
+#endif
+  }
+
+  explicit ThreadPool(unsigned num_workers = default_workers()) {
+    for (unsigned i = 0; i < num_workers; i++)
+      workers_.emplace_back([this] { worker_loop(); });
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lock(mutex_);
+      stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto &worker : workers_)
+      worker.join();
+  }
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  // Threads that take part in parallel_for, including the caller
+  unsigned concurrency() const { return workers_.size() + 1; }
+
+  // Queue a task for a worker, or run it now if there are no workers
+  void submit(std::function<void()> task) {
+    if (workers_.empty()) {
+      task();
+      return;
+    }
+    {
+      std::lock_guard lock(mutex_);
+      tasks_.push_back(std::move(task));
+    }
+    cv_.notify_one();
+  }
+
+  // Call fn(i) for every i in [0, n), spread across the workers and the
+  // calling thread. Blocks until every call has returned.
+  template <typename F> void parallel_for(std::size_t n, F &&fn) {
+    std::atomic<std::size_t> next = 0;
+    auto drain = [&] {
+      for (std::size_t i = next++; i < n; i = next++)
+        fn(i);
+    };
+
+    std::size_t helpers = std::min<std::size_t>(workers_.size(), n);
+    std::mutex done_mutex;
+    std::condition_variable done_cv;
+    std::size_t remaining = helpers;
+    for (std::size_t h = 0; h < helpers; h++) {
+      submit([&] {
+        drain();
+        std::lock_guard lock(done_mutex);
+        if (--remaining == 0)
+          done_cv.notify_one();
+      });
+    }
+    drain();
+
+    std::unique_lock lock(done_mutex);
+    done_cv.wait(lock, [&] { return remaining == 0; });
+  }
+
+private:
+  void worker_loop() {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock lock(mutex_);
+        cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty())
+          return;
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stopping_ = false;
+};
+
+} // namespace common
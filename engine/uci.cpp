@@ -0,0 +1,260 @@
+// Native engine speaking a UCI-like protocol on stdin and stdout, for match
+// tooling.
+//
+// Usage: uci [--tablebase FILE]...
+// Commands, one per line:
+//   uci                     identify, list options, then "uciok"
+//   isready                 "readyok"
+//   setoption name Hash value MB
+//   ucinewgame              clear the transposition table
+//   position startpos|fen FEN [moves MOVE...]
+//   go [depth N] [nodes N] [movetime MS] [wtime MS] [btime MS] [winc MS]
+//      [binc MS] [infinite]
+//   stop                    finish the search and report the best move
+//   quit
+// Moves are written as by Move::to_string: source and destination squares
+// with ranks 10 to 16 as A to G, then any promotion type or defection color,
+// e.g. "h2h4", "iAiC", "i1i1r". White's clock is Player 1's. Each completed
+// depth prints "info depth D score cp S|mate M nodes N nps N time MS pv
+// MOVE...", and the search ends with "bestmove MOVE" ("0000" if there are no
+// legal moves). The search runs on its own thread while commands are read, so
+// stop is seen within a few hundred nodes.
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "position_history.h"
+#include "search.h"
+#include "sovereign_chess.h"
+#include "tablebase.h"
+
+namespace sovereign_chess {
+
+constexpr std::size_t kDefaultHashMegabytes = 16;
+constexpr std::size_t kMaxHashMegabytes = 4096;
+
+// Mate scores as moves to mate, negative when being mated
+std::string score_string(int score) {
+  if (!is_mate_score(score))
+    return "cp " + std::to_string(score);
+  const int plies = kMateScore - std::abs(score);
+  return "mate " + std::to_string(score > 0 ? (plies + 1) / 2 : -plies / 2);
+}
+
+std::optional<Move> find_legal_move(const Board &board,
+                                    const std::string &text) {
+  for (const Move &move : Game::get_legal_moves(board)) {
+    if (move.to_string() == text)
+      return move;
+  }
+  return {};
+}
+
+class Engine {
+public:
+  explicit Engine(const Tablebases *tablebases)
+      : tablebases_(tablebases),
+        table_(std::make_unique<TranspositionTable>(kDefaultHashMegabytes)) {
+    set_position(Board::from_fen(kInitialFen));
+  }
+  ~Engine() { stop(); }
+
+  // False once the engine should exit
+  bool handle(const std::string &line) {
+    std::istringstream in(line);
+    std::string command;
+    in >> command;
+    if (command == "uci") {
+      send("id name Sovereign Chess");
+      send("option name Hash type spin default " +
+           std::to_string(kDefaultHashMegabytes) + " min 1 max " +
+           std::to_string(kMaxHashMegabytes));
+      send("uciok");
+    } else if (command == "isready") {
+      send("readyok");
+    } else if (command == "setoption") {
+      stop();
+      set_option(in);
+    } else if (command == "ucinewgame") {
+      stop();
+      table_->clear();
+    } else if (command == "position") {
+      stop();
+      position(in);
+    } else if (command == "go") {
+      stop();
+      go(in);
+    } else if (command == "stop") {
+      stop();
+    } else if (command == "quit") {
+      return false;
+    } else if (!command.empty()) {
+      send("info string unknown command " + command);
+    }
+    return true;
+  }
+
+private:
+  void send(const std::string &line) {
+    std::lock_guard lock(output_mutex_);
+    std::cout << line << std::endl;
+  }
+
+  void set_position(const Board &board) {
+    board_ = board;
+    history_.clear();
+    history_.push(board_);
+  }
+
+  void set_option(std::istringstream &in) {
+    std::string word, name, value;
+    while (in >> word && word != "name") {
+    }
+    while (in >> word && word != "value")
+      name += (name.empty() ? "" : " ") + word;
+    in >> value;
+    if (name == "Hash") {
+      std::size_t megabytes = 0;
+      std::istringstream(value) >> megabytes;
+      megabytes = std::clamp<std::size_t>(megabytes, 1, kMaxHashMegabytes);
+      table_ = std::make_unique<TranspositionTable>(megabytes);
+    } else {
+      send("info string unknown option " + name);
+    }
+  }
+
+  // A bad FEN or illegal move leaves the position at the last valid one
+  void position(std::istringstream &in) {
+    std::string word;
+    in >> word;
+    if (word == "startpos") {
+      set_position(Board::from_fen(kInitialFen));
+      in >> word;
+    } else if (word == "fen") {
+      std::string fen;
+      while (in >> word && word != "moves")
+        fen += (fen.empty() ? "" : " ") + word;
+      if (!is_valid_fen(fen)) {
+        send("info string invalid fen");
+        return;
+      }
+      set_position(Board::from_fen(fen));
+    }
+    if (word != "moves")
+      return;
+    while (in >> word) {
+      const std::optional<Move> move = find_legal_move(board_, word);
+      if (!move) {
+        send("info string illegal move " + word);
+        return;
+      }
+      board_.make_move(*move);
+      history_.push(board_);
+    }
+  }
+
+  void go(std::istringstream &in) {
+    SearchLimits limits;
+    double clock[2] = {0, 0}, increment[2] = {0, 0};
+    bool infinite = false;
+    for (std::string word; in >> word;) {
+      double value = 0;
+      if (word == "infinite") {
+        infinite = true;
+        continue;
+      }
+      in >> value;
+      if (word == "depth")
+        limits.depth = std::clamp<double>(value, 1, kMaxPly - 1);
+      else if (word == "nodes")
+        limits.nodes = value;
+      else if (word == "movetime")
+        limits.seconds = value / 1000;
+      else if (word == "wtime" || word == "btime")
+        clock[word == "btime"] = value / 1000;
+      else if (word == "winc" || word == "binc")
+        increment[word == "binc"] = value / 1000;
+    }
+    // A slice of the remaining time, keeping a reserve
+    const int side = board_.player_to_move() == Player::Player2;
+    if (limits.seconds == 0 && clock[side] > 0 && !infinite)
+      limits.seconds = std::min(clock[side] / 40 + increment[side] / 2,
+                                clock[side] / 2);
+
+    stop_ = false;
+    limits.stop = &stop_;
+    searching_ = true;
+    search_thread_ = std::thread([this, limits, infinite, board = board_,
+                                  history = history_] {
+      Searcher searcher(*table_, tablebases_);
+      const SearchResult result =
+          searcher.search(board, history, limits, [&](const SearchResult &r) {
+            std::ostringstream info;
+            info << "info depth " << r.depth << " score "
+                 << score_string(r.score) << " nodes " << r.nodes << " nps "
+                 << static_cast<uint64_t>(r.nodes / std::max(r.seconds, 1e-6))
+                 << " time " << static_cast<uint64_t>(r.seconds * 1000)
+                 << " pv";
+            for (const Move &move : r.pv)
+              info << " " << move.to_string();
+            send(info.str());
+          });
+      // An infinite search reports only once stopped
+      if (infinite)
+        stop_.wait(false);
+      send("bestmove " +
+           (result.best_move ? result.best_move->to_string() : "0000"));
+    });
+  }
+
+  // Interrupts any search, which then reports its best move
+  void stop() {
+    if (!searching_)
+      return;
+    stop_ = true;
+    stop_.notify_all();
+    search_thread_.join();
+    searching_ = false;
+  }
+
+  const Tablebases *tablebases_;
+  std::unique_ptr<TranspositionTable> table_;
+  Board board_;
+  PositionHistory history_; // ending with board_
+  std::atomic<bool> stop_ = false;
+  bool searching_ = false;
+  std::thread search_thread_;
+  std::mutex output_mutex_;
+};
+
+} // namespace sovereign_chess
+
+int main(int argc, char **argv) {
+  using namespace sovereign_chess;
+  Tablebases tablebases;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg != "--tablebase" || i + 1 >= argc) {
+      std::cerr << "Usage: uci [--tablebase FILE]...\n";
+      return 1;
+    }
+    if (!tablebases.load(argv[++i])) {
+      std::cerr << "Can't load tablebase " << argv[i] << "\n";
+      return 1;
+    }
+  }
+
+  Engine engine(&tablebases);
+  for (std::string line; std::getline(std::cin, line);) {
+    if (!engine.handle(line))
+      break;
+  }
+  return 0;
+}
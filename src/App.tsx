@@ -28,6 +28,10 @@ interface Engine {
   selectMove(fen: FEN): Move | undefined;
   getOwnedColor(fen: FEN, activePlayer: boolean): Color;
   getControlledColors(fen: FEN, activePlayer: boolean): Color[];
+  getCacheStats(): { hits: number, misses: number, entries: number };
+  // Returns true if ponderStep must be called to make progress
+  startPondering(fen: FEN): boolean;
+  ponderStep(): boolean;
 }
 
 const colorCharToName = new Map<string, Color>(
@@ -40,6 +44,9 @@ function wrapModule(Module: EngineModule) {
   const selectMove = Module.cwrap('select_move', 'string', ['string']);
   const getOwnedColor = Module.cwrap('get_owned_color', 'string', ['string', 'boolean']);
   const getControlledColors = Module.cwrap('get_controlled_colors', 'string', ['string', 'boolean']);
+  const getCacheStats = Module.cwrap('get_cache_stats', 'string', []);
+  const startPondering = Module.cwrap('start_pondering', 'boolean', ['string']);
+  const ponderStep = Module.cwrap('ponder_step', 'boolean', []);
   return {
     getLegalMoves: (fen: FEN) => getLegalMoves(fen).split(' '),
     makeMove: makeMove,
@@ -50,7 +57,13 @@ function wrapModule(Module: EngineModule) {
       if (!colorStr)
         return [];
       return colorStr.split(' ').map((colorChar) => colorCharToName.get(colorChar)!)
-    }
+    },
+    getCacheStats: () => {
+      const [hits, misses, entries] = getCacheStats().split(' ').map(Number);
+      return { hits, misses, entries };
+    },
+    startPondering: startPondering,
+    ponderStep: ponderStep
   };
 }
 
@@ -79,7 +92,13 @@ function movelistToDests(movelist: Move[]) {
   return dests;
 }
 export const key2pos = (k: Key): Pos => [k.charCodeAt(0) - 97, k.charCodeAt(1) < 58 ? k.charCodeAt(1) - 49 : k.charCodeAt(1) - 65 + 9];
-const turnPlayer = (fen: FEN): Side => fen.split(" ")[1] === 'w' ? Side.White : Side.Black;
+// Player 1 plays the white side. The active field is the mover's owned color,
+// which changes on defection, so compare it with Player 1's owned color
+// (white if the field is missing).
+const turnPlayer = (engine: Engine, fen: FEN): Side => {
+  const ownedColors = fen.split(" ")[2] ?? 'wb';
+  return engine.getOwnedColor(fen, true).charAt(0) === ownedColors.charAt(0) ? Side.White : Side.Black;
+};
 const pieceNames = new Map([
   ['pawn', 'p'],
   ['bishop', 'b'],
@@ -114,6 +133,9 @@ function App() {
   const computerMoveDelayRef = useRef(computerMoveDelay);
   computerMoveDelayRef.current = computerMoveDelay;
 
+  // Pending ponder step, for engine builds without threads
+  const ponderTimer = useRef<ReturnType<typeof setTimeout>>();
+
   useEffect(() => {
     createModule().then((Module: EngineModule) => {
       setEngine(wrapModule(Module));
@@ -144,6 +166,7 @@ function App() {
           move += pieceNames.get(promotionRole);
 
 
+        clearTimeout(ponderTimer.current);
         const newFen = engine!.makeMove(oldFen, move);
         if (respondToMovesRef.current)
           setTimeout(() => autoplayMove(newFen), computerMoveDelayRef.current);
@@ -167,16 +190,29 @@ function App() {
     if (fullAutoplayRef.current || forceFullAutoplay) {
       console.log("Scheduling autoplay");
       setTimeout(() => autoplayMove(newFen), computerMoveDelayRef.current);
+    } else {
+      ponder(newFen);
     }
   }
 
+  // Search the user's replies while they think, a step at a time between
+  // events if the engine has no threads
+  function ponder(fen: FEN) {
+    const step = () => {
+      if (engine!.ponderStep())
+        ponderTimer.current = setTimeout(step, 0);
+    };
+    if (engine!.startPondering(fen))
+      ponderTimer.current = setTimeout(step, 0);
+  }
+
   if (!engine) {
     return <div>"Loading..."</div>; // TODO(samkhal)
   }
 
   const config = {
     fen: fen,
-    turnPlayer: turnPlayer(fen),
+    turnPlayer: turnPlayer(engine, fen),
     premovable: {
       enabled: false
     },
@@ -219,7 +255,7 @@ function App() {
 
 
   // TODO fix this
-  const selfIsActivePlayer = turnPlayer(fen) === Side.White;
+  const selfIsActivePlayer = turnPlayer(engine, fen) === Side.White;
 
   return (
     <ThemeProvider theme={darkTheme}>